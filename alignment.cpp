@@ -26,34 +26,49 @@ int hts_for_each_parallel(string& filename, function<void(Alignment&)> lambda) {
 
     samFile *in = hts_open(filename.c_str(), "r");
     if (in == NULL) return 0;
+    int thread_count = get_thread_count();
+    // let htslib decompress BGZF blocks on its own threads
+    // where it doesn't support that for reading this has no effect
+    if (thread_count > 1) hts_set_threads(in, thread_count);
     bam_hdr_t *hdr = sam_hdr_read(in);
     map<string, string> rg_sample;
     parse_rg_sample_map(hdr->text, rg_sample);
 
-    int thread_count = get_thread_count();
-    vector<bam1_t*> bs; bs.resize(thread_count);
-    for (auto& b : bs) {
-        b = bam_init1();
+    // each thread reads a batch of records per trip through the input lock,
+    // then converts and processes them on its own
+    const int batch_size = 256;
+    vector<vector<bam1_t*> > batches; batches.resize(thread_count);
+    for (auto& batch : batches) {
+        batch.resize(batch_size);
+        for (auto& b : batch) {
+            b = bam_init1();
+        }
     }
 
     bool more_data = true;
 #pragma omp parallel shared(in, hdr, more_data, rg_sample)
     {
         int tid = omp_get_thread_num();
+        vector<bam1_t*>& batch = batches[tid];
         while (more_data) {
-            bam1_t* b = bs[tid];
+            int count = 0;
 #pragma omp critical (hts_input)
             if (more_data) {
-                more_data = sam_read1(in, hdr, b) >= 0;
+                while (count < batch_size && sam_read1(in, hdr, batch[count]) >= 0) {
+                    ++count;
+                }
+                more_data = count == batch_size;
             }
-            if (more_data) {
-                Alignment a = bam_to_alignment(b, rg_sample);
+            for (int i = 0; i < count; ++i) {
+                Alignment a = bam_to_alignment(batch[i], rg_sample);
                 lambda(a);
             }
         }
     }
 
-    for (auto& b : bs) bam_destroy1(b);
+    for (auto& batch : batches) {
+        for (auto& b : batch) bam_destroy1(b);
+    }
     bam_hdr_destroy(hdr);
     hts_close(in);
     return 1;
@@ -93,35 +108,95 @@ bam_hdr_t* hts_string_header(string& header,
     return h;
 }
 
-bool get_next_alignment_from_fastq(gzFile fp, char* buffer, size_t len, Alignment& alignment) {
+FastqReader::FastqReader(const string& filename, size_t block_size)
+    : block(block_size)
+    , begin(0)
+    , end(0)
+    , at_eof(false) {
+    fp = (filename != "-") ? gzopen(filename.c_str(), "r") : gzdopen(fileno(stdin), "r");
+    if (fp == NULL) {
+        cerr << "[vg::alignment] could not open " << filename << endl;
+        exit(1);
+    }
+    gzbuffer(fp, block_size);
+}
+
+FastqReader::~FastqReader(void) {
+    gzclose(fp);
+}
+
+bool FastqReader::next_line(const char*& line, size_t& length) {
+    while (true) {
+        char* start = block.data() + begin;
+        char* newline = (char*) memchr(start, '\n', end - begin);
+        if (newline != NULL) {
+            line = start;
+            length = newline - start;
+            begin += length + 1;
+            return true;
+        }
+        if (at_eof) {
+            // hand out a last line with no trailing newline
+            if (begin == end) return false;
+            line = start;
+            length = end - begin;
+            begin = end;
+            return true;
+        }
+        // move the partial line to the front and refill the rest of the block
+        // growing it if a single line doesn't fit
+        memmove(block.data(), start, end - begin);
+        end -= begin;
+        begin = 0;
+        if (end == block.size()) {
+            block.resize(block.size() * 2);
+        }
+        int read = gzread(fp, block.data() + end, block.size() - end);
+        if (read < 0) {
+            cerr << "[vg::alignment] error reading fastq input" << endl;
+            exit(1);
+        }
+        if (read == 0) {
+            at_eof = true;
+        }
+        end += read;
+    }
+}
+
+bool get_next_alignment_from_fastq(FastqReader& in, Alignment& alignment) {
 
     alignment.Clear();
 
+    const char* line;
+    size_t length;
+
     // handle name
-    if (0!=gzgets(fp,buffer,len)) {
-        buffer[strlen(buffer)-1] = '\0';
-        string name = buffer;
-        name = name.substr(1); // trim off leading @
+    if (in.next_line(line, length)) {
+        // trim off leading @
         // XXX todo trim trailing /1 /2
-        alignment.set_name(name);
+        if (length > 0) alignment.set_name(line + 1, length - 1);
     } else { return false; }
     // handle sequence
-    if (0!=gzgets(fp,buffer,len)) {
-        buffer[strlen(buffer)-1] = '\0';
-        alignment.set_sequence(buffer);
+    if (in.next_line(line, length)) {
+        alignment.set_sequence(line, length);
     } else {
         cerr << "[vg::alignment.cpp] error: incomplete fastq record" << endl; exit(1);
     }
     // handle "+" sep
-    if (0!=gzgets(fp,buffer,len)) {
+    if (in.next_line(line, length)) {
     } else {
         cerr << "[vg::alignment.cpp] error: incomplete fastq record" << endl; exit(1);
     }
     // handle quality
-    if (0!=gzgets(fp,buffer,len)) {
-        buffer[strlen(buffer)-1] = '\0';
-        string quality = string_quality_char_to_short(buffer);
-        alignment.set_quality(quality);
+    if (in.next_line(line, length)) {
+        // convert in place in the message's own storage
+        // a plain loop over raw bytes, which the compiler can vectorize
+        string* quality = alignment.mutable_quality();
+        quality->resize(length);
+        char* q = &(*quality)[0];
+        for (size_t i = 0; i < length; ++i) {
+            q[i] = line[i] - 33;
+        }
     } else {
         cerr << "[vg::alignment.cpp] error: incomplete fastq record" << endl; exit(1);
     }
@@ -130,165 +205,133 @@ bool get_next_alignment_from_fastq(gzFile fp, char* buffer, size_t len, Alignmen
 
 }
 
-bool get_next_interleaved_alignment_pair_from_fastq(gzFile fp, char* buffer, size_t len, Alignment& mate1, Alignment& mate2) {
-    return get_next_alignment_from_fastq(fp, buffer, len, mate1) && get_next_alignment_from_fastq(fp, buffer, len, mate2);
+bool get_next_interleaved_alignment_pair_from_fastq(FastqReader& in, Alignment& mate1, Alignment& mate2) {
+    return get_next_alignment_from_fastq(in, mate1) && get_next_alignment_from_fastq(in, mate2);
 }
 
-bool get_next_alignment_pair_from_fastqs(gzFile fp1, gzFile fp2, char* buffer, size_t len, Alignment& mate1, Alignment& mate2) {
-    return get_next_alignment_from_fastq(fp1, buffer, len, mate1) && get_next_alignment_from_fastq(fp2, buffer, len, mate2);
+bool get_next_alignment_pair_from_fastqs(FastqReader& in1, FastqReader& in2, Alignment& mate1, Alignment& mate2) {
+    return get_next_alignment_from_fastq(in1, mate1) && get_next_alignment_from_fastq(in2, mate2);
 }
 
+// The parallel readers take records from the input in batches, so the input
+// lock is taken once per batch rather than once per record. Each thread keeps
+// its batch between rounds, so the messages' storage is reused.
+const size_t fastq_batch_size = 256;
 
 size_t fastq_unpaired_for_each_parallel(string& filename, function<void(Alignment&)> lambda) {
-    gzFile fp = (filename != "-") ? gzopen(filename.c_str(), "r") : gzdopen(fileno(stdin), "r");
-    size_t len = 2 << 18; // 256k
+    FastqReader in(filename);
     size_t nLines = 0;
-    int thread_count = get_thread_count();
-    //vector<Alignment> alns; alns.resize(thread_count);
-    vector<char*> bufs; bufs.resize(thread_count);
-    for (auto& buf : bufs) {
-        buf = new char[len];
-    }
     bool more_data = true;
-#pragma omp parallel shared(fp, more_data, bufs)
+#pragma omp parallel shared(in, more_data, nLines)
     {
-        int tid = omp_get_thread_num();
+        vector<Alignment> batch(fastq_batch_size);
         while (more_data) {
-            Alignment aln;
-            char* buf = bufs[tid];
+            size_t count = 0;
 #pragma omp critical (fastq_input)
             if (more_data) {
-                more_data = get_next_alignment_from_fastq(fp, buf, len, aln);
-                nLines++;
+                while (count < fastq_batch_size
+                       && get_next_alignment_from_fastq(in, batch[count])) {
+                    ++count;
+                }
+                more_data = count == fastq_batch_size;
+                nLines += count;
             }
-            if (more_data) {
-                lambda(aln);
+            for (size_t i = 0; i < count; ++i) {
+                lambda(batch[i]);
             }
         }
     }
-    for (auto& buf : bufs) {
-        delete buf;
-    }
-    gzclose(fp);
     return nLines;
 }
 
 size_t fastq_paired_interleaved_for_each_parallel(string& filename, function<void(Alignment&, Alignment&)> lambda) {
-    gzFile fp = (filename != "-") ? gzopen(filename.c_str(), "r") : gzdopen(fileno(stdin), "r");
-    size_t len = 2 << 18; // 256k
+    FastqReader in(filename);
     size_t nLines = 0;
-    int thread_count = get_thread_count();
-    //vector<Alignment> alns; alns.resize(thread_count);
-    vector<char*> bufs; bufs.resize(thread_count);
-    for (auto& buf : bufs) {
-        buf = new char[len];
-    }
     bool more_data = true;
-#pragma omp parallel shared(fp, more_data, bufs)
+#pragma omp parallel shared(in, more_data, nLines)
     {
-        int tid = omp_get_thread_num();
+        vector<Alignment> batch1(fastq_batch_size);
+        vector<Alignment> batch2(fastq_batch_size);
         while (more_data) {
-            Alignment mate1, mate2;
-            char* buf = bufs[tid];
+            size_t count = 0;
 #pragma omp critical (fastq_input)
             if (more_data) {
-                more_data = get_next_interleaved_alignment_pair_from_fastq(fp, buf, len, mate1, mate2);
-                nLines++;
+                while (count < fastq_batch_size
+                       && get_next_interleaved_alignment_pair_from_fastq(in, batch1[count], batch2[count])) {
+                    ++count;
+                }
+                more_data = count == fastq_batch_size;
+                nLines += count;
             }
-            if (more_data) {
-                lambda(mate1, mate2);
+            for (size_t i = 0; i < count; ++i) {
+                lambda(batch1[i], batch2[i]);
             }
         }
     }
-    for (auto& buf : bufs) {
-        delete buf;
-    }
-    gzclose(fp);
     return nLines;
 }
 
 size_t fastq_paired_two_files_for_each_parallel(string& file1, string& file2, function<void(Alignment&, Alignment&)> lambda) {
-    gzFile fp1 = (file1 != "-") ? gzopen(file1.c_str(), "r") : gzdopen(fileno(stdin), "r");
-    gzFile fp2 = (file2 != "-") ? gzopen(file2.c_str(), "r") : gzdopen(fileno(stdin), "r");
-    size_t len = 2 << 18; // 256k
+    FastqReader in1(file1);
+    FastqReader in2(file2);
     size_t nLines = 0;
-    int thread_count = get_thread_count();
-    //vector<Alignment> alns; alns.resize(thread_count);
-    vector<char*> bufs; bufs.resize(thread_count);
-    for (auto& buf : bufs) {
-        buf = new char[len];
-    }
     bool more_data = true;
-#pragma omp parallel shared(fp1, fp2, more_data, bufs)
+#pragma omp parallel shared(in1, in2, more_data, nLines)
     {
-        int tid = omp_get_thread_num();
+        vector<Alignment> batch1(fastq_batch_size);
+        vector<Alignment> batch2(fastq_batch_size);
         while (more_data) {
-            Alignment mate1, mate2;
-            char* buf = bufs[tid];
+            size_t count = 0;
 #pragma omp critical (fastq_input)
             if (more_data) {
-                more_data = get_next_alignment_pair_from_fastqs(fp1, fp2, buf, len, mate1, mate2);
-                nLines++;
+                while (count < fastq_batch_size
+                       && get_next_alignment_pair_from_fastqs(in1, in2, batch1[count], batch2[count])) {
+                    ++count;
+                }
+                more_data = count == fastq_batch_size;
+                nLines += count;
             }
-            if (more_data) {
-                lambda(mate1, mate2);
+            for (size_t i = 0; i < count; ++i) {
+                lambda(batch1[i], batch2[i]);
             }
         }
     }
-    for (auto& buf : bufs) {
-        delete buf;
-    }
-    gzclose(fp1);
-    gzclose(fp2);
     return nLines;
 }
 
 
 
 size_t fastq_unpaired_for_each(string& filename, function<void(Alignment&)> lambda) {
-    gzFile fp = (filename != "-") ? gzopen(filename.c_str(), "r") : gzdopen(fileno(stdin), "r");
-    size_t len = 2 << 18; // 256k
+    FastqReader in(filename);
     size_t nLines = 0;
-    char *buffer = new char[len];
     Alignment alignment;
-    while(get_next_alignment_from_fastq(fp, buffer, len, alignment)) {
+    while(get_next_alignment_from_fastq(in, alignment)) {
         lambda(alignment);
         nLines++;
     }
-    gzclose(fp);
-    delete buffer;
     return nLines;
 }
 
 size_t fastq_paired_interleaved_for_each(string& filename, function<void(Alignment&, Alignment&)> lambda) {
-    gzFile fp = (filename != "-") ? gzopen(filename.c_str(), "r") : gzdopen(fileno(stdin), "r");
-    size_t len = 2 << 18; // 256k
+    FastqReader in(filename);
     size_t nLines = 0;
-    char *buffer = new char[len];
     Alignment mate1, mate2;
-    while(get_next_interleaved_alignment_pair_from_fastq(fp, buffer, len, mate1, mate2)) {
+    while(get_next_interleaved_alignment_pair_from_fastq(in, mate1, mate2)) {
         lambda(mate1, mate2);
         nLines++;
     }
-    gzclose(fp);
-    delete buffer;
     return nLines;
 }
 
 size_t fastq_paired_two_files_for_each(string& file1, string& file2, function<void(Alignment&, Alignment&)> lambda) {
-    gzFile fp1 = (file1 != "-") ? gzopen(file1.c_str(), "r") : gzdopen(fileno(stdin), "r");
-    gzFile fp2 = (file2 != "-") ? gzopen(file2.c_str(), "r") : gzdopen(fileno(stdin), "r");
-    size_t len = 2 << 18; // 256k
+    FastqReader in1(file1);
+    FastqReader in2(file2);
     size_t nLines = 0;
-    char *buffer = new char[len];
     Alignment mate1, mate2;
-    while(get_next_alignment_pair_from_fastqs(fp1, fp2, buffer, len, mate1, mate2)) {
+    while(get_next_alignment_pair_from_fastqs(in1, in2, mate1, mate2)) {
         lambda(mate1, mate2);
         nLines++;
     }
-    gzclose(fp1);
-    gzclose(fp2);
-    delete buffer;
     return nLines;
 
 }
@@ -392,6 +435,33 @@ string string_quality_char_to_short(const string& quality) {
     return buffer;
 }
 
+// remember to clean up with bam_destroy1(b);
+bam1_t* alignment_to_bam(bam_hdr_t* header,
+                         const Alignment& alignment,
+                         const string& refseq,
+                         const int32_t refpos,
+                         const string& cigar,
+                         const string& mateseq,
+                         const int32_t matepos,
+                         const int32_t tlen) {
+
+    string sam = alignment_to_sam(alignment, refseq, refpos, cigar, mateseq, matepos, tlen);
+    // sam_parse1 takes a single line without its newline, and may modify it
+    if (!sam.empty() && sam[sam.size()-1] == '\n') sam.resize(sam.size()-1);
+    kstring_t line;
+    line.l = sam.size();
+    line.m = sam.size() + 1;
+    line.s = &sam[0];
+    bam1_t *aln = bam_init1();
+    if (sam_parse1(&line, header, aln) >= 0) {
+        return aln;
+    } else {
+        cerr << "[vg::alignment] Failure to parse SAM record" << endl
+             << sam << endl;
+        exit(1);
+    }
+}
+
 // remember to clean up with bam_destroy1(b);
 bam1_t* alignment_to_bam(const string& sam_header,
                          const Alignment& alignment,
@@ -474,7 +544,7 @@ int32_t sam_flag(const Alignment& alignment) {
     if (alignment.score() == 0) {
         // unmapped
         flag |= BAM_FUNMAP;
-    } else {
+    } else if (!alignment.discordant_pair()) {
         // correctly aligned
         flag |= BAM_FPROPER_PAIR;
     }
@@ -503,12 +573,15 @@ Alignment bam_to_alignment(const bam1_t *b, map<string, string>& rg_sample) {
     }
 
     // get the read group and sample name
+    // this is called from many threads at once, so only look up in rg_sample
     uint8_t *rgptr = bam_aux_get(b, "RG");
-    char* rg = (char*) (rgptr+1);
-    //if (!rg_sample
+    char* rg = rgptr ? (char*) (rgptr+1) : NULL;
     string sname;
-    if (!rg_sample.empty()) {
-        sname = rg_sample[string(rg)];
+    if (rg && !rg_sample.empty()) {
+        auto s = rg_sample.find(string(rg));
+        if (s != rg_sample.end()) {
+            sname = s->second;
+        }
     }
 
     // add features to the alignment
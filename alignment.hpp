@@ -11,18 +11,38 @@
 #include "htslib/hfile.h"
 #include "htslib/hts.h"
 #include "htslib/sam.h"
+#include "htslib/kstring.h"
 #include "htslib/vcf.h"
 
 namespace vg {
 
 const char* const BAM_DNA_LOOKUP = "=ACMGRSVTWYHKDBN";
 
+// Reads lines from a (possibly gzipped) file, or stdin if the name is "-".
+// Input is decompressed in large blocks and split on newlines with memchr,
+// and lines are handed out as pointers into the block, so parsing a record
+// needs no per-line library calls or temporary strings.
+class FastqReader {
+public:
+    FastqReader(const string& filename, size_t block_size = 1 << 20);
+    ~FastqReader(void);
+    // Point line at the next line (without its newline) and set length.
+    // The line is valid until the next call. Returns false at end of input.
+    bool next_line(const char*& line, size_t& length);
+private:
+    gzFile fp;
+    vector<char> block;
+    size_t begin; // start of the unread part of the block
+    size_t end; // end of the valid data in the block
+    bool at_eof;
+};
+
 int hts_for_each(string& filename, function<void(Alignment&)> lambda);
 int hts_for_each_parallel(string& filename, function<void(Alignment&)> lambda);
 int fastq_for_each(string& filename, function<void(Alignment&)> lambda);
-bool get_next_alignment_from_fastq(gzFile fp, char* buffer, size_t len, Alignment& alignment);
-bool get_next_interleaved_alignment_pair_from_fastq(gzFile fp, char* buffer, size_t len, Alignment& mate1, Alignment& mate2);
-bool get_next_alignment_pair_from_fastqs(gzFile fp1, gzFile fp2, char* buffer, size_t len, Alignment& mate1, Alignment& mate2);
+bool get_next_alignment_from_fastq(FastqReader& in, Alignment& alignment);
+bool get_next_interleaved_alignment_pair_from_fastq(FastqReader& in, Alignment& mate1, Alignment& mate2);
+bool get_next_alignment_pair_from_fastqs(FastqReader& in1, FastqReader& in2, Alignment& mate1, Alignment& mate2);
 
 size_t fastq_unpaired_for_each(string& filename, function<void(Alignment&)> lambda);
 size_t fastq_paired_interleaved_for_each(string& filename, function<void(Alignment&, Alignment&)> lambda);
@@ -40,6 +60,18 @@ void write_alignments(std::ostream& out, vector<Alignment>& buf);
 
 Alignment bam_to_alignment(const bam1_t *b, map<string, string>& rg_sample);
 
+// Parses the record against an already-built header, so nothing but the
+// record itself is parsed per call. Safe to call from many threads once the
+// header's name lookup has been built, e.g. by one call to bam_name2id.
+bam1_t* alignment_to_bam(bam_hdr_t* header,
+                         const Alignment& alignment,
+                         const string& refseq,
+                         const int32_t refpos,
+                         const string& cigar,
+                         const string& mateseq,
+                         const int32_t matepos,
+                         const int32_t tlen);
+
 bam1_t* alignment_to_bam(const string& sam_header,
                          const Alignment& alignment,
                          const string& refseq,
@@ -4,26 +4,110 @@ namespace vg {
 
 using namespace std;
 
-double entropy(string& st) {
-    vector<char> stvec(st.begin(), st.end());
-    set<char> alphabet(stvec.begin(), stvec.end());
-    vector<double> freqs;
-    for (set<char>::iterator c = alphabet.begin(); c != alphabet.end(); ++c) {
-        int ctr = 0;
-        for (vector<char>::iterator s = stvec.begin(); s != stvec.end(); ++s) {
-            if (*s == *c) {
-                ++ctr;
-            }
-        }
-        freqs.push_back((double)ctr / (double)stvec.size());
+// n log2 n, from a table for counts up to the length of most windows
+static double n_log_n(size_t n) {
+    static const vector<double> table = [](void) {
+        vector<double> t(1024);
+        for (size_t i = 1; i < t.size(); ++i) t[i] = i * log2(i);
+        return t;
+    }();
+    return n < table.size() ? table[n] : n * log2(n);
+}
+
+double entropy(const string& st) {
+    return entropy(st.c_str(), st.size());
+}
+
+double entropy(const char* st, size_t length) {
+    if (length == 0) return 0;
+    int counts[256] = {0};
+    for (size_t i = 0; i < length; ++i) {
+        ++counts[(unsigned char) st[i]];
     }
     double ent = 0;
-    double ln2 = log(2);
-    for (vector<double>::iterator f = freqs.begin(); f != freqs.end(); ++f) {
-        ent += *f * log(*f)/ln2;
+    for (int c = 0; c < 256; ++c) {
+        if (counts[c]) {
+            double f = (double) counts[c] / (double) length;
+            ent += f * log2(f);
+        }
+    }
+    return -ent;
+}
+
+void window_entropies(const string& seq, int window, vector<double>& entropies) {
+    entropies.clear();
+    if (window <= 0 || seq.size() < (size_t) window) return;
+    entropies.reserve(seq.size() - window + 1);
+    // The entropy of the window is log2(window) - sum(c log2 c) / window,
+    // over the counts c of its symbols, so we only need to keep the sum up to
+    // date as symbols enter and leave.
+    int counts[256] = {0};
+    double sum = 0;
+    auto add = [&](unsigned char c) { sum += n_log_n(counts[c] + 1) - n_log_n(counts[c]); ++counts[c]; };
+    auto remove = [&](unsigned char c) { sum += n_log_n(counts[c] - 1) - n_log_n(counts[c]); --counts[c]; };
+    double log_window = log2(window);
+    for (int i = 0; i < window; ++i) add(seq[i]);
+    entropies.push_back(log_window - sum / window);
+    for (size_t i = window; i < seq.size(); ++i) {
+        remove(seq[i - window]);
+        add(seq[i]);
+        entropies.push_back(log_window - sum / window);
+    }
+}
+
+// triplets of ACGT as a number from 0 to 63, or -1 if any base is something else
+static int triplet_code(const string& seq, size_t i) {
+    int code = 0;
+    for (size_t j = i; j < i + 3; ++j) {
+        int b;
+        switch (seq[j]) {
+        case 'A': case 'a': b = 0; break;
+        case 'C': case 'c': b = 1; break;
+        case 'G': case 'g': b = 2; break;
+        case 'T': case 't': b = 3; break;
+        default: return -1;
+        }
+        code = code << 2 | b;
+    }
+    return code;
+}
+
+void dust_scores(const string& seq, int window, vector<double>& scores) {
+    scores.clear();
+    if (window < 4 || seq.size() < (size_t) window) return;
+    scores.reserve(seq.size() - window + 1);
+    int triplets = window - 2;
+    // the code of the triplet starting at each base
+    vector<int> codes(seq.size() - 2);
+    for (size_t i = 0; i < codes.size(); ++i) codes[i] = triplet_code(seq, i);
+    // keep the count of each triplet in the window, and the number of pairs
+    // of identical triplets, updating both as the window slides
+    int counts[64] = {0};
+    int pairs = 0;
+    auto add = [&](int code) { if (code >= 0) pairs += counts[code]++; };
+    auto remove = [&](int code) { if (code >= 0) pairs -= --counts[code]; };
+    for (int i = 0; i < triplets; ++i) add(codes[i]);
+    scores.push_back((double) pairs / (triplets - 1));
+    for (size_t i = triplets; i < codes.size(); ++i) {
+        remove(codes[i - triplets]);
+        add(codes[i]);
+        scores.push_back((double) pairs / (triplets - 1));
+    }
+}
+
+void dust_mask(const string& seq, int window, double threshold, vector<bool>& masked) {
+    masked.assign(seq.size(), false);
+    // sequences shorter than the window aren't scored, so stay unmasked
+    vector<double> scores;
+    dust_scores(seq, window, scores);
+    // mark each window over the threshold, never marking a base twice
+    size_t marked_to = 0;
+    for (size_t i = 0; i < scores.size(); ++i) {
+        if (scores[i] > threshold) {
+            for (size_t j = max(i, marked_to); j < i + window; ++j) masked[j] = true;
+            marked_to = i + window;
+        }
     }
-    ent = -ent;
-    return ent;
 }
 
 }
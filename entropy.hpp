@@ -11,7 +11,23 @@ namespace vg {
 
 using namespace std;
 
-double entropy(string& st);
+// shannon entropy of the symbols in the string, in bits
+double entropy(const string& st);
+double entropy(const char* st, size_t length);
+
+// entropy of every window of the given size along the sequence, computed in
+// one pass by updating symbol counts as the window slides;
+// entropies[i] is for the window starting at i
+void window_entropies(const string& seq, int window, vector<double>& entropies);
+
+// DUST score of every window of the given size along the sequence: the
+// number of pairs of identical triplets in the window, over the number of
+// triplets less one, so low complexity sequence scores high;
+// scores[i] is for the window starting at i
+void dust_scores(const string& seq, int window, vector<double>& scores);
+
+// mark the bases in windows scoring above the threshold
+void dust_mask(const string& seq, int window, double threshold, vector<bool>& masked);
 
 }
 
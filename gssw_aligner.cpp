@@ -22,7 +22,7 @@ GSSWAligner::GSSWAligner(
     gap_extension = _gap_extension;
 
     // these are used when setting up the nodes
-    // they can be cleaned up via destroy_alignable_graph()
+    // they are cleaned up in the destructor
     nt_table = gssw_create_nt_table();
 	score_matrix = gssw_create_score_matrix(match, mismatch);
 
@@ -74,6 +74,40 @@ GSSWAligner::GSSWAligner(
 }
 
 
+GSSWAligner::GSSWAligner(
+    vector<Node*>& sorted_nodes,
+    vector<pair<int64_t, int64_t> >& edges,
+    int32_t _match,
+    int32_t _mismatch,
+    int32_t _gap_open,
+    int32_t _gap_extension
+) {
+
+    match = _match;
+    mismatch = _mismatch;
+    gap_open = _gap_open;
+    gap_extension = _gap_extension;
+
+    nt_table = gssw_create_nt_table();
+    score_matrix = gssw_create_score_matrix(match, mismatch);
+
+    graph = gssw_graph_create(sorted_nodes.size());
+
+    for (Node* n : sorted_nodes) {
+        gssw_node* node = (gssw_node*)gssw_node_create(n, n->id(),
+                                                       n->sequence().c_str(),
+                                                       nt_table,
+                                                       score_matrix);
+        nodes[n->id()] = node;
+        gssw_graph_add_node(graph, node);
+    }
+
+    for (auto& edge : edges) {
+        gssw_nodes_add_edge(nodes[edge.first], nodes[edge.second]);
+    }
+
+}
+
 void GSSWAligner::align(Alignment& alignment) {
 
     const string& sequence = alignment.sequence();
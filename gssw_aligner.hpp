@@ -23,6 +23,17 @@ public:
         int32_t _gap_open = 3,
         int32_t _gap_extension = 1);
 
+    // Build the alignable graph straight from nodes that are already in
+    // topological order, linked end to start by the given (from, to) ids.
+    // The nodes are not copied, so they have to outlive the aligner.
+    GSSWAligner(
+        vector<Node*>& sorted_nodes,
+        vector<pair<int64_t, int64_t> >& edges,
+        int32_t _match = 2,
+        int32_t _mismatch = 2,
+        int32_t _gap_open = 3,
+        int32_t _gap_extension = 1);
+
     ~GSSWAligner(void);
 
     // for construction
@@ -1,4 +1,5 @@
 #include "index.hpp"
+#include <queue>
 
 namespace vg {
 
@@ -257,6 +258,23 @@ const string Index::key_for_path_position(int64_t path_id, int64_t path_pos, boo
     return key;
 }
 
+const string Index::key_for_path_anchors(int64_t path_id, int64_t node_id, bool backward) {
+    path_id = htobe64(path_id);
+    node_id = htobe64(node_id);
+    string key;
+    key.resize(6*sizeof(char) + 2*sizeof(int64_t));
+    char* k = (char*) key.c_str();
+    k[0] = start_sep;
+    k[1] = 'o'; // path anchors
+    k[2] = start_sep;
+    memcpy(k + sizeof(char)*3, &path_id, sizeof(int64_t));
+    k[3 + sizeof(int64_t)] = start_sep;
+    memcpy(k + sizeof(char)*4 + sizeof(int64_t), &node_id, sizeof(int64_t));
+    k[4 + 2*sizeof(int64_t)] = start_sep;
+    k[5 + 2*sizeof(int64_t)] = backward ? '1' : '0';
+    return key;
+}
+
 const string Index::key_prefix_for_kmer(const string& kmer) {
     string key;
     key.resize(3*sizeof(char) + kmer.size());
@@ -369,6 +387,9 @@ string Index::entry_to_string(const string& key, const string& value) {
     case 'a':
         return alignment_entry_to_string(key, value);
         break;
+    case 'o':
+        return path_anchors_to_string(key, value);
+        break;
     default:
         break;
     }
@@ -533,6 +554,34 @@ void Index::parse_path_position(const string& key, const string& value,
     mapping.ParseFromString(value);
 }
 
+void Index::parse_path_anchors(const string& key, const string& value, int64_t& path_id, int64_t& node_id, bool& backward,
+                               list<pair<int64_t, bool>>& path_prev, int64_t& prev_pos, bool& prev_orientation,
+                               list<pair<int64_t, bool>>& path_next, int64_t& next_pos, bool& next_orientation) {
+    const char* k = key.c_str();
+    memcpy(&path_id, (k + 3*sizeof(char)), sizeof(int64_t));
+    memcpy(&node_id, (k + 4*sizeof(char)+sizeof(int64_t)), sizeof(int64_t));
+    backward = (k[5 + 2*sizeof(int64_t)] == '1');
+    path_id = be64toh(path_id);
+    node_id = be64toh(node_id);
+    // each side is the position and orientation where we meet the path, then
+    // the number of oriented nodes on the way there and the nodes themselves
+    const char* v = value.c_str();
+    auto parse_side = [&v](list<pair<int64_t, bool>>& path, int64_t& pos, bool& orientation) {
+        memcpy(&pos, v, sizeof(int64_t)); v += sizeof(int64_t);
+        orientation = (*v++ == '1');
+        int64_t count;
+        memcpy(&count, v, sizeof(int64_t)); v += sizeof(int64_t);
+        path.clear();
+        for (int64_t i = 0; i < count; ++i) {
+            int64_t id;
+            memcpy(&id, v, sizeof(int64_t)); v += sizeof(int64_t);
+            path.push_back(make_pair(id, *v++ == '1'));
+        }
+    };
+    parse_side(path_prev, prev_pos, prev_orientation);
+    parse_side(path_next, next_pos, next_orientation);
+}
+
 void Index::parse_mapping(const string& key, const string& value, int64_t& node_id, string& hash, Mapping& mapping) {
     const char* k = key.c_str();
     memcpy(&node_id, (k + 3*sizeof(char)), sizeof(int64_t));
@@ -573,6 +622,30 @@ string Index::path_position_to_string(const string& key, const string& value) {
     return s.str();
 }
 
+string Index::path_anchors_to_string(const string& key, const string& value) {
+    int64_t path_id, node_id, prev_pos, next_pos;
+    bool backward, prev_orientation, next_orientation;
+    list<pair<int64_t, bool>> path_prev, path_next;
+    parse_path_anchors(key, value, path_id, node_id, backward,
+                       path_prev, prev_pos, prev_orientation,
+                       path_next, next_pos, next_orientation);
+    auto side_to_string = [](const list<pair<int64_t, bool>>& path, int64_t pos, bool orientation) {
+        stringstream s;
+        s << "{\"pos\":" << pos << ", \"orientation\":" << (orientation ? "true" : "false") << ", \"path\":[";
+        for (auto n = path.begin(); n != path.end(); ++n) {
+            if (n != path.begin()) s << ",";
+            s << n->first * (n->second ? -1 : 1);
+        }
+        s << "]}";
+        return s.str();
+    };
+    stringstream s;
+    s << "{\"key\":\"+o+" << path_id << "+" << node_id << "+" << (backward ? '1' : '0')
+      << "\", \"value\":{\"prev\":" << side_to_string(path_prev, prev_pos, prev_orientation)
+      << ", \"next\":" << side_to_string(path_next, next_pos, next_orientation) << "}}";
+    return s.str();
+}
+
 string Index::metadata_entry_to_string(const string& key, const string& value) {
     stringstream s;
     string prefix = key.substr(3);
@@ -704,6 +777,21 @@ void Index::batch_edge(const Edge* edge, rocksdb::WriteBatch& batch) {
     }
 }
 
+void Index::batch_remove_edge(const Edge* edge, rocksdb::WriteBatch& batch) {
+    // remove the keys on both nodes, as put_edge stores them
+    bool backward = (edge->from_start() != edge->to_end());
+    if(edge->from_start()) {
+        batch.Delete(key_for_edge_on_start(edge->from(), edge->to(), backward));
+    } else {
+        batch.Delete(key_for_edge_on_end(edge->from(), edge->to(), backward));
+    }
+    if(edge->to_end()) {
+        batch.Delete(key_for_edge_on_end(edge->to(), edge->from(), backward));
+    } else {
+        batch.Delete(key_for_edge_on_start(edge->to(), edge->from(), backward));
+    }
+}
+
 void Index::put_metadata(const string& tag, const string& data) {
     string key = key_for_metadata(tag);
     db->Put(write_options, key, data);
@@ -753,6 +841,74 @@ void Index::load_graph(VG& graph) {
     omp_set_num_threads(thread_count);
 }
 
+void Index::remove_nodes(VG& graph, const set<int64_t>& ids) {
+    rocksdb::WriteBatch batch;
+    for (auto id : ids) {
+        Node* node = graph.get_node(id);
+        batch.Delete(key_for_node(id));
+        vector<Edge*> edges;
+        graph.edges_of_node(node, edges);
+        for (auto edge : edges) {
+            batch_remove_edge(edge, batch);
+        }
+    }
+    map<string, int64_t> path_ids;
+    for_each_node_path_position(graph, ids, [this, &batch, &path_ids](const string& name,
+                                                                      int64_t path_pos,
+                                                                      const Mapping& mapping) {
+            auto p = path_ids.find(name);
+            if (p == path_ids.end()) {
+                p = path_ids.insert(make_pair(name, get_path_id(name))).first;
+            }
+            int64_t path_id = p->second;
+            // the path was never stored
+            if (!path_id) return;
+            int64_t node_id = mapping.position().node_id();
+            batch.Delete(key_for_path_position(path_id, path_pos, mapping.is_reverse(), node_id));
+            batch.Delete(key_for_node_path_position(node_id, path_id, path_pos, mapping.is_reverse()));
+        });
+    rocksdb::Status s = db->Write(write_options, &batch);
+    if (!s.ok()) { cerr << "[vg::Index] error: could not remove nodes from the index" << endl; exit(1); }
+    if (clear_path_anchors()) {
+        cerr << "[vg::Index] warning: removing nodes dropped the stored path anchors, "
+             << "rebuild the index with -O to store them again" << endl;
+    }
+}
+
+void Index::put_nodes(VG& graph, const set<int64_t>& ids) {
+    rocksdb::WriteBatch batch;
+    for (auto id : ids) {
+        Node* node = graph.get_node(id);
+        batch_node(node, batch);
+        vector<Edge*> edges;
+        graph.edges_of_node(node, edges);
+        for (auto edge : edges) {
+            batch_edge(edge, batch);
+        }
+    }
+    map<string, int64_t> path_ids;
+    for_each_node_path_position(graph, ids, [this, &batch, &path_ids](const string& name,
+                                                                      int64_t path_pos,
+                                                                      const Mapping& mapping) {
+            auto p = path_ids.find(name);
+            if (p == path_ids.end()) {
+                int64_t path_id = get_path_id(name);
+                if (!path_id) {
+                    path_id = new_path_id(name);
+                }
+                p = path_ids.insert(make_pair(name, path_id)).first;
+            }
+            int64_t path_id = p->second;
+            int64_t node_id = mapping.position().node_id();
+            string data;
+            mapping.SerializeToString(&data);
+            batch.Put(key_for_path_position(path_id, path_pos, mapping.is_reverse(), node_id), data);
+            batch.Put(key_for_node_path_position(node_id, path_id, path_pos, mapping.is_reverse()), data);
+        });
+    rocksdb::Status s = db->Write(write_options, &batch);
+    if (!s.ok()) { cerr << "[vg::Index] error: could not store nodes in the index" << endl; exit(1); }
+}
+
 void Index::load_paths(VG& graph) {
     graph.destroy_progress();
     graph.create_progress("indexing paths of " + graph.name, graph.paths._paths.size());
@@ -868,6 +1024,29 @@ void Index::store_path(VG& graph, Path& path) {
     }
 }
 
+void Index::for_each_node_path_position(VG& graph, const set<int64_t>& ids,
+                                        function<void(const string&, int64_t, const Mapping&)> lambda) {
+    // only walk the paths the nodes are on
+    set<string> path_names;
+    for (auto id : ids) {
+        if (graph.paths.has_node_mapping(id)) {
+            for (auto& name : graph.paths.of_node(id)) {
+                path_names.insert(name);
+            }
+        }
+    }
+    for (auto& name : path_names) {
+        int64_t path_pos = 0;
+        for (auto& mapping : graph.paths.get_path(name)) {
+            int64_t node_id = mapping.position().node_id();
+            if (ids.count(node_id)) {
+                lambda(name, path_pos, mapping);
+            }
+            path_pos += graph.get_node(node_id)->sequence().size();
+        }
+    }
+}
+
 rocksdb::Status Index::get_metadata(const string& key, string& data) {
     rocksdb::Status s = db->Get(rocksdb::ReadOptions(), key_for_metadata(key), &data);
     return s;
@@ -1144,6 +1323,17 @@ bool Index::get_node_path_relative_position(int64_t node_id, bool backward, int6
     
     list<pair<int64_t, bool>> nullpath;
     auto null_pair = make_pair(nullpath, make_pair((int64_t)0, false));
+
+    // if vg index stored where the searches end up, we don't need to search
+    if (get_path_anchors(node_id, backward, path_id,
+                         path_prev, prev_pos, prev_orientation,
+                         path_next, next_pos, next_orientation)) {
+        if (next_orientation != prev_orientation) {
+            cerr << "meets path in different orientations from different ends" << endl;
+            return false;
+        }
+        return true;
+    }
     
     auto to_path_prev = get_nearest_node_prev_path_member(node_id, backward, path_id, prev_pos, prev_orientation);
     if (to_path_prev == null_pair) {
@@ -1170,6 +1360,92 @@ bool Index::get_node_path_relative_position(int64_t node_id, bool backward, int6
     return true;
 }
 
+void Index::store_path_anchors(VG& graph) {
+    graph.create_progress("indexing path anchors of " + graph.name, graph.paths._paths.size());
+    function<void(Path&)> lambda = [this, &graph](Path& path) {
+        int64_t path_id = get_path_id(path.name());
+        int64_t graph_path_id = graph.paths.get_path_id(path.name());
+        graph.for_each_node([this, &graph, &path_id, &graph_path_id](Node* node) {
+                // the searches from nodes on the path stop where they start,
+                // so there's nothing to save by storing them
+                if (graph.paths.has_node_mapping(node)) {
+                    for (auto& m : graph.paths.get_node_mapping(node)) {
+                        if (m.first == graph_path_id) return;
+                    }
+                }
+                for (auto backward : {false, true}) {
+                    // run the searches as they'd be run for a query
+                    list<pair<int64_t, bool>> path_prev, path_next;
+                    int64_t prev_pos = 0, next_pos = 0;
+                    bool prev_orientation, next_orientation;
+                    path_prev = get_nearest_node_prev_path_member(node->id(), backward, path_id,
+                                                                  prev_pos, prev_orientation).first;
+                    path_next = get_nearest_node_next_path_member(node->id(), backward, path_id,
+                                                                  next_pos, next_orientation).first;
+                    // only store what the searches reach; queries for the
+                    // rest fall back to searching
+                    if (path_prev.empty() || path_next.empty()) continue;
+                    put_path_anchors(path_id, node->id(), backward,
+                                     path_prev, prev_pos, prev_orientation,
+                                     path_next, next_pos, next_orientation);
+                }
+            });
+        graph.update_progress(graph.progress_count+1);
+    };
+    graph.paths.for_each(lambda);
+    graph.destroy_progress();
+}
+
+void Index::put_path_anchors(int64_t path_id, int64_t node_id, bool backward,
+                             const list<pair<int64_t, bool>>& path_prev, int64_t prev_pos, bool prev_orientation,
+                             const list<pair<int64_t, bool>>& path_next, int64_t next_pos, bool next_orientation) {
+    string data;
+    auto put_side = [&data](const list<pair<int64_t, bool>>& path, int64_t pos, bool orientation) {
+        data.append((char*) &pos, sizeof(int64_t));
+        data.push_back(orientation ? '1' : '0');
+        int64_t count = path.size();
+        data.append((char*) &count, sizeof(int64_t));
+        for (auto& n : path) {
+            data.append((char*) &n.first, sizeof(int64_t));
+            data.push_back(n.second ? '1' : '0');
+        }
+    };
+    put_side(path_prev, prev_pos, prev_orientation);
+    put_side(path_next, next_pos, next_orientation);
+    rocksdb::Status s = db->Put(write_options, key_for_path_anchors(path_id, node_id, backward), data);
+    if (!s.ok()) { cerr << "put of path anchors for " << node_id << " failed" << endl; exit(1); }
+}
+
+bool Index::get_path_anchors(int64_t node_id, bool backward, int64_t path_id,
+                             list<pair<int64_t, bool>>& path_prev, int64_t& prev_pos, bool& prev_orientation,
+                             list<pair<int64_t, bool>>& path_next, int64_t& next_pos, bool& next_orientation) {
+    string value;
+    string key = key_for_path_anchors(path_id, node_id, backward);
+    rocksdb::Status s = db->Get(rocksdb::ReadOptions(), key, &value);
+    if (!s.ok()) return false;
+    int64_t stored_path_id, stored_node_id;
+    bool stored_backward;
+    parse_path_anchors(key, value, stored_path_id, stored_node_id, stored_backward,
+                       path_prev, prev_pos, prev_orientation,
+                       path_next, next_pos, next_orientation);
+    return true;
+}
+
+size_t Index::clear_path_anchors(void) {
+    string start = string(1, start_sep) + "o" + start_sep;
+    string end = string(1, start_sep) + "o" + end_sep;
+    rocksdb::WriteBatch batch;
+    size_t count = 0;
+    for_range(start, end, [&batch, &count](string& key, string& value) {
+            batch.Delete(key);
+            ++count;
+        });
+    if (!count) return 0;
+    rocksdb::Status s = db->Write(write_options, &batch);
+    if (!s.ok()) { cerr << "[vg::Index] error: could not clear path anchors" << endl; exit(1); }
+    return count;
+}
+
 Mapping Index::path_relative_mapping(int64_t node_id, bool backward, int64_t path_id,
                                      list<pair<int64_t, bool>>& path_prev, int64_t& prev_pos, bool& prev_orientation,
                                      list<pair<int64_t, bool>>& path_next, int64_t& next_pos, bool& next_orientation) {
@@ -1226,17 +1502,28 @@ bool Index::surject_alignment(const Alignment& source,
                               Alignment& surjection,
                               string& path_name,
                               int64_t& path_pos,
-                              int window) {
+                              int window,
+                              bool project) {
     VG graph;
-    // get start and end nodes in path
-    // get range between +/- window
+    // get the graph within window bases of the nodes we mapped to
     if (!source.has_path() || source.path().mapping_size() == 0) {
         return false;
     }
-    // TODO: replace ID windowing with a real notion of region
-    int64_t from_id = source.path().mapping(0).position().node_id() - window;
-    int64_t to_id = source.path().mapping(source.path().mapping_size()-1).position().node_id() + window;
-    get_range(max((int64_t)0, from_id), to_id, graph);
+    // reads that already follow one of the paths don't need realigning
+    for (auto& name : path_names) {
+        if (!project) break;
+        const PathOffsets* offsets = get_path_offsets(name);
+        if (offsets && project_alignment(source, *offsets, path_pos)) {
+            surjection = source;
+            path_name = name;
+            return true;
+        }
+    }
+    set<int64_t> ids;
+    for (auto& mapping : source.path().mapping()) {
+        ids.insert(mapping.position().node_id());
+    }
+    get_context_within(ids, window, graph);
     graph.remove_orphan_edges();
     // which path(s) did we keep?
     set<string> kept_paths;
@@ -1275,6 +1562,86 @@ bool Index::surject_alignment(const Alignment& source,
     }
 }
 
+const PathOffsets* Index::get_path_offsets(const string& name) {
+    const PathOffsets* found = NULL;
+    // surjection runs threaded, so the first thread to need a path reads it
+    // while the others wait; after that the entry never moves
+#pragma omp critical (path_offsets)
+    {
+        auto f = path_offsets.find(name);
+        if (f != path_offsets.end()) {
+            found = &f->second;
+        } else {
+            PathOffsets& offsets = path_offsets[name];
+            load_path_offsets(name, offsets);
+            found = &offsets;
+        }
+    }
+    // paths we don't have are remembered as empty
+    return found->steps.empty() ? NULL : found;
+}
+
+void Index::load_path_offsets(const string& name, PathOffsets& offsets) {
+    int64_t path_id = get_path_id(name);
+    if (path_id == 0) return; // not a path we have
+    string key_start = key_for_path_position(path_id, 0, false, 0);
+    string key_end = key_for_path_position(path_id+1, 0, false, 0);
+    // the steps come in order along the path
+    for_range(key_start, key_end, [this, &offsets](string& key, string& data) {
+            Mapping mapping;
+            int64_t path_id, path_pos, node_id;
+            bool backward;
+            parse_path_position(key, data,
+                                path_id, path_pos, backward,
+                                node_id, mapping);
+            if (!offsets.steps.empty()) {
+                offsets.steps.back().length = path_pos - offsets.steps.back().offset;
+            }
+            offsets.node_steps[node_id].push_back(offsets.steps.size());
+            offsets.steps.push_back(PathOffsets::Step{node_id, path_pos, 0, backward});
+        });
+    // the last node is the only one we need to look at to know its length
+    if (!offsets.steps.empty()) {
+        Node node;
+        get_node(offsets.steps.back().node_id, node);
+        offsets.steps.back().length = node.sequence().size();
+    }
+}
+
+bool Index::project_alignment(const Alignment& alignment, const PathOffsets& offsets, int64_t& path_pos) {
+    auto& path = alignment.path();
+    if (path.mapping_size() == 0) return false;
+    auto first = offsets.node_steps.find(path.mapping(0).position().node_id());
+    if (first == offsets.node_steps.end()) return false;
+    // try each place the path visits the first node, in case it loops
+    for (auto s : first->second) {
+        bool on_path = true;
+        for (size_t i = 0; i < path.mapping_size(); ++i) {
+            auto& mapping = path.mapping(i);
+            if (s + i >= offsets.steps.size()) {
+                on_path = false;
+                break;
+            }
+            auto& step = offsets.steps[s + i];
+            if (step.node_id != mapping.position().node_id()
+                || step.backward != mapping.is_reverse()) {
+                on_path = false;
+                break;
+            }
+        }
+        if (!on_path) continue;
+        // as in the realigned case, the position is that of the node on the
+        // path plus our offset in the node, from its left side
+        auto& step = offsets.steps[s];
+        auto& position = path.mapping(0).position();
+        path_pos = step.offset + (path.mapping(0).is_reverse()
+                                  ? step.length - position.offset() - 1
+                                  : position.offset());
+        return true;
+    }
+    return false;
+}
+
 map<string, int64_t> Index::paths_by_id(void) {
     map<string, int64_t> byid;
     string start = key_for_metadata(path_id_prefix(0));
@@ -1503,6 +1870,57 @@ void Index::get_range(int64_t from_id, int64_t to_id, VG& graph) {
     for_graph_range(from_id, to_id, handle_entry);
 }
 
+void Index::get_context_within(const set<int64_t>& ids, int64_t length, VG& graph) {
+    for_each_node_within(ids, length, graph, [](int64_t id, int64_t d) { return true; });
+}
+
+int64_t Index::get_distance_within(const set<int64_t>& from, const set<int64_t>& to, int64_t length) {
+    int64_t distance = -1;
+    VG graph;
+    for_each_node_within(from, length, graph, [&to, &distance](int64_t id, int64_t d) {
+            if (!to.count(id)) return true;
+            distance = d;
+            return false;
+        });
+    return distance;
+}
+
+void Index::for_each_node_within(const set<int64_t>& ids, int64_t length, VG& graph,
+                                 const function<bool(int64_t, int64_t)>& lambda) {
+    // Search out from the nodes we start with, in order of distance, where
+    // stepping past a node costs its length. Nodes are fetched as they come
+    // up, and their edges tell us where to go next.
+    map<int64_t, int64_t> distance;
+    priority_queue<pair<int64_t, int64_t>,
+                   vector<pair<int64_t, int64_t> >,
+                   greater<pair<int64_t, int64_t> > > queue;
+    for (auto id : ids) {
+        distance[id] = 0;
+        queue.push(make_pair(0, id));
+    }
+    while (!queue.empty()) {
+        int64_t d = queue.top().first;
+        int64_t id = queue.top().second;
+        queue.pop();
+        if (d > distance[id]) continue;
+        get_context(id, graph);
+        if (!graph.has_node(id)) continue; // not in the index
+        if (!lambda(id, d)) return;
+        // the nodes we start from are where we measure from
+        int64_t past = d + (ids.count(id) ? 0 : graph.get_node(id)->sequence().size());
+        if (past > length) continue;
+        for (auto* edges : { &graph.edges_start(id), &graph.edges_end(id) }) {
+            for (auto& edge : *edges) {
+                auto found = distance.find(edge.first);
+                if (found == distance.end() || past < found->second) {
+                    distance[edge.first] = past;
+                    queue.push(make_pair(past, edge.first));
+                }
+            }
+        }
+    }
+}
+
 void Index::get_kmer_subgraph(const string& kmer, VG& graph) {
     // get the nodes in the kmer subgraph
     for_kmer_range(kmer, [&graph, this](string& key, string& value) {
@@ -1840,6 +2258,47 @@ void Index::prune_kmers(int max_kb_on_disk) {
         });
 }
 
+void Index::remove_kmers_of_nodes(VG& graph, const set<int64_t>& ids, int kmer_size, int edge_max) {
+    rocksdb::WriteBatch batch;
+    // the kmers of a node include those that are stored against a neighbor
+    // instead, and removing keys that don't exist does no harm
+    auto lambda = [this, &batch](string& kmer, list<NodeTraversal>::iterator n, int p,
+                                 list<NodeTraversal>& path, VG& graph) {
+        batch.Delete(key_for_kmer(kmer, (*n).node->id()));
+    };
+    for (auto id : ids) {
+        graph.for_each_kmer_of_node(graph.get_node(id), kmer_size, edge_max, lambda);
+    }
+    rocksdb::Status s = db->Write(write_options, &batch);
+    if (!s.ok()) { cerr << "[vg::Index] error: could not remove kmers from the index" << endl; exit(1); }
+}
+
+void Index::index_kmers_of_nodes(VG& graph, const set<int64_t>& ids, int kmer_size, int edge_max) {
+    rocksdb::WriteBatch batch;
+    auto lambda = [this, &batch, kmer_size](string& kmer, list<NodeTraversal>::iterator n, int p,
+                                            list<NodeTraversal>& path, VG& graph) {
+        if (!allATGC(kmer)) return;
+        // find the node the kmer ends in
+        list<NodeTraversal>::iterator end = n;
+        int remaining = p + kmer_size;
+        while (remaining > (*end).node->sequence().size()) {
+            remaining -= (*end).node->sequence().size();
+            ++end;
+        }
+        // the full pass only stores kmers that cross nodes against the end
+        // with the lower id, which is the start unless the kmer was flipped
+        // (for a kmer that starts and ends in the same node we may also store
+        // its flipped copy, which is still a true hit)
+        if ((*end).node->id() < (*n).node->id()) return;
+        batch_kmer(kmer, (*n).node->id(), p, batch);
+    };
+    for (auto id : ids) {
+        graph.for_each_kmer_of_node(graph.get_node(id), kmer_size, edge_max, lambda);
+    }
+    rocksdb::Status s = db->Write(write_options, &batch);
+    if (!s.ok()) { cerr << "[vg::Index] error: could not store kmers in the index" << endl; exit(1); }
+}
+
 void Index::remember_kmer_size(int size) {
     stringstream s;
     s << "k=" << size;
@@ -76,11 +76,27 @@ namespace vg {
   +g+node_id+p+path_id+pos+backward     mapping [vg::Mapping]
   +k+kmer+node_id                       position of kmer in node [int32_t]
   +p+path_id+pos+backward+node_id       mapping [vg::Mapping]
+  +o+path_id+node_id+backward           nearest path members on each side [raw, see put_path_anchors]
   +s+node_id+offset                     mapping [vg::Mapping] // mapping-only "side" against one node
   +a+node_id+offset                     alignment [vg::Alignment]
 
  */
 
+// Where the nodes of a path fall along it, held in memory so positions on
+// the path can be found without going back to the database.
+struct PathOffsets {
+    struct Step {
+        int64_t node_id;
+        int64_t offset; // of the first base of the node on the path
+        int64_t length;
+        bool backward;
+    };
+    // the path's nodes in order
+    vector<Step> steps;
+    // where each node is in steps; more than once if the path loops
+    hash_map<int64_t, vector<size_t> > node_steps;
+};
+
 class Index {
 
 public:
@@ -117,6 +133,12 @@ public:
     size_t block_cache_size;
 
     void load_graph(VG& graph);
+    // Incremental updates, for when a graph that is already indexed is edited.
+    // Remove the records of the given nodes, of their edges (at both ends), and
+    // of their places on paths, as they stand in the graph before the edit.
+    void remove_nodes(VG& graph, const set<int64_t>& ids);
+    // Store the same records for the given nodes as they stand after it.
+    void put_nodes(VG& graph, const set<int64_t>& ids);
     void dump(std::ostream& out);
     void for_all(std::function<void(string&, string&)> lambda);
     void for_range(string& key_start, string& key_end,
@@ -126,6 +148,7 @@ public:
     void put_edge(const Edge* edge);
     void batch_node(const Node* node, rocksdb::WriteBatch& batch);
     void batch_edge(const Edge* edge, rocksdb::WriteBatch& batch);
+    void batch_remove_edge(const Edge* edge, rocksdb::WriteBatch& batch);
     // Put a kmer that starts at the given index in the given node in the index.
     // The index only stores the kmers that are on the forward strand at their
     // start positions. The aligner is responsible for searching both strands of
@@ -165,6 +188,7 @@ public:
     const string key_for_path_position(int64_t path_id, int64_t path_pos, bool backward, int64_t node_id);
     const string key_for_node_path_position(int64_t node_id, int64_t path_id, int64_t path_pos, bool backward);
     const string key_prefix_for_node_path(int64_t node_id, int64_t path_id);
+    const string key_for_path_anchors(int64_t path_id, int64_t node_id, bool backward);
     const string key_for_mapping_prefix(int64_t node_id);
     const string key_for_mapping(const Mapping& mapping);
     const string key_for_alignment_prefix(int64_t node_id);
@@ -184,6 +208,9 @@ public:
                          int64_t& node_id, int64_t& path_id, int64_t& path_pos, bool& backward, Mapping& mapping);
     void parse_path_position(const string& key, const string& value,
                              int64_t& path_id, int64_t& path_pos, bool& backward, int64_t& node_id, Mapping& mapping);
+    void parse_path_anchors(const string& key, const string& value, int64_t& path_id, int64_t& node_id, bool& backward,
+                            list<pair<int64_t, bool>>& path_prev, int64_t& prev_pos, bool& prev_orientation,
+                            list<pair<int64_t, bool>>& path_next, int64_t& next_pos, bool& next_orientation);
     void parse_mapping(const string& key, const string& value, int64_t& node_id, string& hash, Mapping& mapping);
     void parse_alignment(const string& key, const string& value, int64_t& node_id, string& hash, Alignment& alignment);
 
@@ -191,6 +218,7 @@ public:
     string entry_to_string(const string& key, const string& value);
     string graph_entry_to_string(const string& key, const string& value);
     string kmer_entry_to_string(const string& key, const string& value);
+    string path_anchors_to_string(const string& key, const string& value);
     string position_entry_to_string(const string& key, const string& value);
     string metadata_entry_to_string(const string& key, const string& value);
     string node_path_to_string(const string& key, const string& value);
@@ -203,6 +231,20 @@ public:
     void expand_context(VG& graph, int steps);
     // Add all the elements in the given range to the given graph, if they aren't in it already.
     void get_range(int64_t from_id, int64_t to_id, VG& graph);
+    // Add everything within length bases of the given nodes to the given
+    // graph, walking edges out from them in either direction. Each node comes
+    // with its edges and path memberships, as with get_context; edges to nodes
+    // too far away are left dangling.
+    void get_context_within(const set<int64_t>& ids, int64_t length, VG& graph);
+    // The number of bases in the nodes between the given sets of nodes, along
+    // the shortest walk joining them in either direction, or -1 if they are
+    // more than length bases apart. Sets that share a node are 0 apart.
+    int64_t get_distance_within(const set<int64_t>& from, const set<int64_t>& to, int64_t length);
+    // Visit the nodes within length bases of the given ones, nearest first,
+    // adding each to graph with its context and passing its id and distance
+    // to lambda. Stops early if lambda returns false.
+    void for_each_node_within(const set<int64_t>& ids, int64_t length, VG& graph,
+                              const function<bool(int64_t, int64_t)>& lambda);
     void for_graph_range(int64_t from_id, int64_t to_id, function<void(string&, string&)> lambda);
     void get_connected_nodes(VG& graph);
     // Get the edges on the end of the given node
@@ -244,7 +286,24 @@ public:
     get_nearest_node_next_path_member(int64_t node_id, bool backward, int64_t path_id,
                                       int64_t& path_pos, bool& relative_orientation,
                                       int max_steps = 4);
+    // The nearest path members on either side of each node, as the
+    // breadth-first searches above find them, can be stored ahead of time so
+    // that path position queries are a single lookup. This stores them for
+    // both orientations of the nodes off each path that the searches reach it
+    // from; queries for any other node search as before.
+    void store_path_anchors(VG& graph);
+    void put_path_anchors(int64_t path_id, int64_t node_id, bool backward,
+                          const list<pair<int64_t, bool>>& path_prev, int64_t prev_pos, bool prev_orientation,
+                          const list<pair<int64_t, bool>>& path_next, int64_t next_pos, bool next_orientation);
+    // Fill in what was stored for the node, returning false if nothing was.
+    bool get_path_anchors(int64_t node_id, bool backward, int64_t path_id,
+                          list<pair<int64_t, bool>>& path_prev, int64_t& prev_pos, bool& prev_orientation,
+                          list<pair<int64_t, bool>>& path_next, int64_t& next_pos, bool& next_orientation);
+    // Editing the graph can change any node's nearest path members, so drop
+    // them all. Returns how many were dropped.
+    size_t clear_path_anchors(void);
     // Get the relative position, in both directions, of the given orientation of the given node along the given path.
+    // Uses the stored path anchors if there are any.
     bool get_node_path_relative_position(int64_t node_id, bool backward, int64_t path_id,
                                          list<pair<int64_t, bool>>& path_prev, int64_t& prev_pos, bool& prev_orientation,
                                          list<pair<int64_t, bool>>& path_next, int64_t& next_pos, bool& next_orientation);
@@ -253,12 +312,26 @@ public:
                                   list<pair<int64_t, bool>>& path_prev, int64_t& prev_pos, bool& prev_orientation,
                                   list<pair<int64_t, bool>>& path_next, int64_t& next_pos, bool& next_orientation);
                                   
+    // Surject the alignment onto the given paths. If it already runs along
+    // one of them, and project is set, its position is read off the path;
+    // otherwise it's aligned to them within window bases of where it mapped.
     bool surject_alignment(const Alignment& source,
                            set<string>& path_names,
                            Alignment& surjection,
                            string& path_name,
                            int64_t& path_pos,
-                           int window = 5);
+                           int window = 50,
+                           bool project = true);
+    // The steps of the named path, read from the database the first time
+    // they're asked for and kept in path_offsets; NULL if we have no such
+    // path. Safe to call from several threads.
+    const PathOffsets* get_path_offsets(const string& name);
+    void load_path_offsets(const string& name, PathOffsets& offsets);
+    map<string, PathOffsets> path_offsets;
+    // If the alignment goes forward along the path through consecutive
+    // nodes, fill in the position on the path where it starts and return
+    // true.
+    bool project_alignment(const Alignment& alignment, const PathOffsets& offsets, int64_t& path_pos);
     // Populates layout with path start and end nodes (and orientations),
     // indexed by path names, and lengths with path lengths indexed by path
     // names.
@@ -278,6 +351,12 @@ public:
     // In the given map by kmer, fill in the vector with the node IDs and offsets at which the given kmer starts.
     void get_kmer_positions(const string& kmer, map<string, vector<pair<int64_t, int32_t> > >& positions);
     void prune_kmers(int max_kb_on_disk);
+    // Remove any kmers that could have been stored against the given nodes as
+    // they stand in graph.
+    void remove_kmers_of_nodes(VG& graph, const set<int64_t>& ids, int kmer_size, int edge_max);
+    // Store the kmers of the given nodes that index_kmers, run over all of
+    // graph with a stride of 1, would store against them.
+    void index_kmers_of_nodes(VG& graph, const set<int64_t>& ids, int kmer_size, int edge_max);
 
     void remember_kmer_size(int size);
     set<int> stored_kmer_sizes(void);
@@ -300,6 +379,11 @@ public:
     void load_paths(VG& graph);
     void store_paths(VG& graph); // of graph
     void store_path(VG& graph, Path& path); // path of graph
+    // Run the function on each place the given nodes take on the paths of
+    // graph, with the path name and the position along the path as it is
+    // stored by store_path.
+    void for_each_node_path_position(VG& graph, const set<int64_t>& ids,
+                                     function<void(const string&, int64_t, const Mapping&)> lambda);
     map<string, int64_t> paths_by_id(void);
 
     // alignments and mappings
@@ -227,7 +227,9 @@ void help_surject(char** argv) {
          << "    -b, --bam-output        write BAM to stdout" << endl
          << "    -s, --sam-output        write SAM to stdout" << endl
          << "    -C, --compression N     level for compression [0-9]" << endl
-         << "    -w, --window N          use N nodes on either side of the alignment to surject (default 5)" << endl;
+         << "    -w, --window N          use N bases on either side of the alignment to surject (default 50)" << endl
+         << "    -r, --realign           realign reads that already follow a path rather than reading" << endl
+         << "                            their position off it" << endl;
 }
 
 int main_surject(int argc, char** argv) {
@@ -245,7 +247,8 @@ int main_surject(int argc, char** argv) {
     string input_type = "gam";
     string header_file;
     int compress_level = 9;
-    int window = 5;
+    int window = 50;
+    bool project = true;
     string fasta_filename;
 
     int c;
@@ -266,11 +269,12 @@ int main_surject(int argc, char** argv) {
                 {"header-from", required_argument, 0, 'H'},
                 {"compress", required_argument, 0, 'C'},
                 {"window", required_argument, 0, 'w'},
+                {"realign", no_argument, 0, 'r'},
                 {0, 0, 0, 0}
             };
 
         int option_index = 0;
-        c = getopt_long (argc, argv, "hd:p:i:P:cbsH:C:t:w:f:",
+        c = getopt_long (argc, argv, "hd:p:i:P:cbsH:C:t:w:f:r",
                          long_options, &option_index);
 
         // Detect the end of the options.
@@ -329,6 +333,10 @@ int main_surject(int argc, char** argv) {
             window = atoi(optarg);
             break;
 
+        case 'r':
+            project = false;
+            break;
+
         case 'h':
         case '?':
             help_surject(argv);
@@ -357,20 +365,20 @@ int main_surject(int argc, char** argv) {
     } else {
         path_names.insert(path_name);
     }
-
     if (input_type == "gam") {
         if (output_type == "gam") {
             int thread_count = get_thread_count();
             vector<vector<Alignment> > buffer;
             buffer.resize(thread_count);
-            function<void(Alignment&)> lambda = [&index, &path_names, &buffer, &window](Alignment& src) {
+            stream::ChunkWriter<Alignment> writer(cout);
+            function<void(Alignment&)> lambda = [&index, &path_names, &buffer, &writer, &window, &project](Alignment& src) {
                 int tid = omp_get_thread_num();
                 Alignment surj;
                 string path_name;
                 int64_t path_pos;
-                index.surject_alignment(src, path_names, surj, path_name, path_pos, window);
+                index.surject_alignment(src, path_names, surj, path_name, path_pos, window, project);
                 buffer[tid].push_back(surj);
-                stream::write_buffered(cout, buffer[tid], 1000);
+                writer.write_buffered(buffer[tid], 1000);
             };
             if (file_name == "-") {
                 stream::for_each_parallel(std::cin, lambda);
@@ -380,8 +388,9 @@ int main_surject(int argc, char** argv) {
                 stream::for_each_parallel(in, lambda);
             }
             for (int i = 0; i < thread_count; ++i) {
-                stream::write_buffered(cout, buffer[i], 0); // flush
+                writer.write_buffered(buffer[i], 0); // flush
             }
+            writer.flush();
         } else {
             char out_mode[5];
             string out_format = "";
@@ -424,13 +433,20 @@ int main_surject(int argc, char** argv) {
             // handles buffers, possibly opening the output file if we're on the first record
             auto handle_buffer =
                 [&hdr, &header, &path_length, &rg_sample, &buffer_limit,
-                 &out_mode, &out, &output_lock, &fasta_filename](vector<tuple<string, int64_t, Alignment> >& buf) {
+                 &out_mode, &out_format, &thread_count, &out, &output_lock,
+                 &fasta_filename](vector<tuple<string, int64_t, Alignment> >& buf) {
                 if (buf.size() >= buffer_limit) {
                     // do we have enough data to open the file?
 #pragma omp critical (hts_header)
                     {
                         if (!hdr) {
                             hdr = hts_string_header(header, path_length, rg_sample);
+                            // htslib builds the name lookup of the header on
+                            // first use, so do that here, once, before the
+                            // threads parse records against it
+                            if (hdr->n_targets > 0) {
+                                bam_name2id(hdr, hdr->target_name[0]);
+                            }
                             if ((out = sam_open("-", out_mode)) == 0) {
                                 /*
                                 if (!fasta_filename.empty()) {
@@ -441,6 +457,10 @@ int main_surject(int argc, char** argv) {
                                 cerr << "[vg surject] failed to open stdout for writing HTS output" << endl;
                                 exit(1);
                             } else {
+                                // compress BGZF blocks on a pool of htslib threads
+                                if (out_format == "b" && thread_count > 1) {
+                                    hts_set_threads(out, thread_count);
+                                }
                                 // write the header
                                 if (sam_hdr_write(out, hdr) != 0) {
                                     cerr << "[vg surject] error: failed to write the SAM header" << endl;
@@ -448,29 +468,34 @@ int main_surject(int argc, char** argv) {
                             }
                         }
                     }
-                    // try to get a lock, and force things if we've built up a huge buffer waiting
-                    if (omp_test_lock(&output_lock) || buf.size() > 10*buffer_limit) {
-                        for (auto& s : buf) {
-                            auto& path_nom = get<0>(s);
-                            auto& path_pos = get<1>(s);
-                            auto& surj = get<2>(s);
-                            string cigar = cigar_against_path(surj);
-                            bam1_t* b = alignment_to_bam(header,
-                                                         surj,
-                                                         path_nom,
-                                                         path_pos,
-                                                         cigar,
-                                                         "=",
-                                                         path_pos,
-                                                         0);
-                            int r = 0;
-#pragma omp critical (cout)
-                            r = sam_write1(out, hdr, b);
-                            if (r == 0) { cerr << "[vg surject] error: writing to stdout failed" << endl; exit(1); }
-                            bam_destroy1(b);
-                        }
-                        omp_unset_lock(&output_lock);
-                        buf.clear();
+                    // convert the records in this thread, outside of the lock
+                    vector<bam1_t*> records;
+                    records.reserve(buf.size());
+                    for (auto& s : buf) {
+                        auto& path_nom = get<0>(s);
+                        auto& path_pos = get<1>(s);
+                        auto& surj = get<2>(s);
+                        string cigar = cigar_against_path(surj);
+                        records.push_back(alignment_to_bam(hdr,
+                                                           surj,
+                                                           path_nom,
+                                                           path_pos,
+                                                           cigar,
+                                                           "=",
+                                                           path_pos,
+                                                           0));
+                    }
+                    buf.clear();
+                    // BGZF compression runs on htslib's threads, so holding
+                    // the lock only costs the copy into its buffers
+                    omp_set_lock(&output_lock);
+                    for (auto& b : records) {
+                        int r = sam_write1(out, hdr, b);
+                        if (r < 0) { cerr << "[vg surject] error: writing to stdout failed" << endl; exit(1); }
+                    }
+                    omp_unset_lock(&output_lock);
+                    for (auto& b : records) {
+                        bam_destroy1(b);
                     }
                 }
             };
@@ -479,6 +504,7 @@ int main_surject(int argc, char** argv) {
                                                  &path_names,
                                                  &path_length,
                                                  &window,
+                                                 &project,
                                                  &rg_sample,
                                                  &header,
                                                  &out,
@@ -491,7 +517,7 @@ int main_surject(int argc, char** argv) {
                 Alignment surj;
                 string path_name;
                 int64_t path_pos;
-                index.surject_alignment(src, path_names, surj, path_name, path_pos, window);
+                index.surject_alignment(src, path_names, surj, path_name, path_pos, window, project);
                 if (!surj.path().mapping_size()) {
                     surj = src;
                 }
@@ -534,6 +560,15 @@ void help_mod(char** argv) {
          << endl
          << "options:" << endl
          << "    -i, --include-aln FILE  include the paths implied by alignments in the graph" << endl
+         << "    -v, --vcf FILE          add the variants in FILE to the graph, against the paths named" << endl
+         << "                            after their sequences (as built by vg construct without -R)" << endl
+         << "    -d, --db-name DIR       update the index in DIR (nodes, edges, paths and the kmers of" << endl
+         << "                            its stored sizes, with --edge-max) for the added variants," << endl
+         << "                            rather than rebuilding it; kmers are taken with a stride of 1" << endl
+         << "                            and are not pruned; path anchors stored with vg index -O" << endl
+         << "                            are dropped" << endl
+         << "    -C, --changed FILE      write the ids of the nodes the variants removed, added or" << endl
+         << "                            changed the edges of to FILE, as 'removed|added|changed <id>'" << endl
          << "    -c, --compact-ids       should we sort and compact the id space? (default false)" << endl
          << "    -k, --keep-path NAME    keep only nodes and edges in the path" << endl
          << "    -o, --remove-orphans    remove orphan edges from graph (edge specified but node missing)" << endl
@@ -567,6 +602,9 @@ int main_mod(int argc, char** argv) {
     int chop_to = 0;
     bool add_start_and_end_markers = false;
     bool prune_subgraphs = false;
+    string vcf_file_name;
+    string db_name;
+    string changed_file_name;
 
     int c;
     optind = 2; // force optind past command positional argument
@@ -575,6 +613,9 @@ int main_mod(int argc, char** argv) {
             {
                 {"help", no_argument, 0, 'h'},
                 {"include-aln", required_argument, 0, 'i'},
+                {"vcf", required_argument, 0, 'v'},
+                {"db-name", required_argument, 0, 'd'},
+                {"changed", required_argument, 0, 'C'},
                 {"compact-ids", no_argument, 0, 'c'},
                 {"keep-path", required_argument, 0, 'k'},
                 {"remove-orphans", no_argument, 0, 'o'},
@@ -589,7 +630,7 @@ int main_mod(int argc, char** argv) {
             };
 
         int option_index = 0;
-        c = getopt_long (argc, argv, "hk:oi:cpl:e:mt:SX:",
+        c = getopt_long (argc, argv, "hk:oi:v:d:C:cpl:e:mt:SX:",
                          long_options, &option_index);
 
         // Detect the end of the options.
@@ -603,6 +644,18 @@ int main_mod(int argc, char** argv) {
             aln_file = optarg;
             break;
 
+        case 'v':
+            vcf_file_name = optarg;
+            break;
+
+        case 'd':
+            db_name = optarg;
+            break;
+
+        case 'C':
+            changed_file_name = optarg;
+            break;
+
         case 'c':
             compact_ids = true;
             break;
@@ -697,6 +750,75 @@ int main_mod(int argc, char** argv) {
         }
     }
 
+    if (!vcf_file_name.empty()) {
+        vcflib::VariantCallFile variant_file;
+        variant_file.open(vcf_file_name);
+        if (!variant_file.is_open()) {
+            cerr << "[vg mod]: could not open " << vcf_file_name << endl;
+            return 1;
+        }
+        map<string, map<long, set<vcflib::VariantAllele> > > alleles;
+        graph->vcf_to_alleles(variant_file, alleles);
+        for (auto a = alleles.begin(); a != alleles.end(); ) {
+            if (!graph->paths.has_path(a->first)) {
+                cerr << "[vg mod]: warning, skipping variants on " << a->first
+                     << ", which has no path in the graph" << endl;
+                a = alleles.erase(a);
+            } else {
+                ++a;
+            }
+        }
+
+        Index index;
+        set<int> kmer_sizes;
+        // the nodes we will touch, and those whose kmers we will touch, by kmer size
+        set<int64_t> at_alleles;
+        map<int, set<int64_t> > near_alleles;
+        if (!db_name.empty()) {
+            index.open_for_write(db_name);
+            kmer_sizes = index.stored_kmer_sizes();
+            // clear out what the edit will change while we still have the old graph
+            graph->nodes_at_alleles(alleles, at_alleles);
+            for (auto kmer_size : kmer_sizes) {
+                auto& near = near_alleles[kmer_size];
+                graph->nodes_near(at_alleles, kmer_size, near);
+                index.remove_kmers_of_nodes(*graph, near, kmer_size, edge_max);
+            }
+            index.remove_nodes(*graph, at_alleles);
+        }
+
+        set<int64_t> removed, added, updated;
+        graph->add_alleles(alleles, removed, added, updated);
+
+        if (!db_name.empty()) {
+            set<int64_t> changed = added;
+            changed.insert(updated.begin(), updated.end());
+            // nodes we cleared out that the edit left in place
+            set<int64_t> restore = changed;
+            for (auto id : at_alleles) {
+                if (!removed.count(id)) restore.insert(id);
+            }
+            index.put_nodes(*graph, restore);
+            for (auto kmer_size : kmer_sizes) {
+                set<int64_t> near;
+                graph->nodes_near(changed, kmer_size, near);
+                for (auto id : near_alleles[kmer_size]) {
+                    if (!removed.count(id)) near.insert(id);
+                }
+                index.index_kmers_of_nodes(*graph, near, kmer_size, edge_max);
+            }
+            index.flush();
+            index.close();
+        }
+
+        if (!changed_file_name.empty()) {
+            ofstream out(changed_file_name.c_str());
+            for (auto id : removed) out << "removed " << id << endl;
+            for (auto id : added) out << "added " << id << endl;
+            for (auto id : updated) out << "changed " << id << endl;
+        }
+    }
+
     if (prune_complex) {
         if (!(path_length > 0 && edge_max > 0)) {
             cerr << "[vg mod]: when pruning complex regions you must specify a --path-length and --edge-max" << endl;
@@ -1931,6 +2053,8 @@ void help_index(char** argv) {
          << "    -p, --progress         show progress" << endl
          << "rocksdb options (ignored with -g):" << endl
          << "    -s, --store-graph      store graph (do this first to build db!)" << endl
+         << "    -O, --path-anchors     with -s, also store where each node meets each path, so path" << endl
+         << "                           positions (vg find -P, vg surject) are looked up rather than searched for" << endl
          << "    -m, --store-mappings   input is .gam format, store the mappings in alignments by node" << endl
          << "    -a, --store-alignments input is .gam format, store the alignments by node" << endl
          << "    -A, --dump-alignments  graph contains alignments, output them in sorted order" << endl
@@ -1959,6 +2083,7 @@ int main_index(int argc, char** argv) {
     int kmer_stride = 1;
     int prune_kb = -1;
     bool store_graph = false;
+    bool store_path_anchors = false;
     bool dump_index = false;
     bool describe_index = false;
     bool show_progress = false;
@@ -1984,6 +2109,7 @@ int main_index(int argc, char** argv) {
                 {"edge-max", required_argument, 0, 'e'},
                 {"kmer-stride", required_argument, 0, 'j'},
                 {"store-graph", no_argument, 0, 's'},
+                {"path-anchors", no_argument, 0, 'O'},
                 {"store-alignments", no_argument, 0, 'a'},
                 {"dump-alignments", no_argument, 0, 'A'},
                 {"store-mappings", no_argument, 0, 'm'},
@@ -2002,7 +2128,7 @@ int main_index(int argc, char** argv) {
             };
 
         int option_index = 0;
-        c = getopt_long (argc, argv, "d:k:j:pDshMt:b:e:SP:LmaCnAQgX:",
+        c = getopt_long (argc, argv, "d:k:j:pDshMt:b:e:SP:LmaCnAQgX:O",
                          long_options, &option_index);
         
         // Detect the end of the options.
@@ -2055,6 +2181,10 @@ int main_index(int argc, char** argv) {
             store_graph = true;
             break;
 
+        case 'O':
+            store_path_anchors = true;
+            break;
+
         case 'a':
             store_alignments = true;
             break;
@@ -2153,31 +2283,11 @@ int main_index(int argc, char** argv) {
 
         graphs.show_progress = show_progress;
 
-        // Go get the kmers of the correct size
+        // Go get the kmers of the correct size. The ones that go to the sink
+        // node come back already marked as sorted.
         vector<gcsa::KMer> kmers;
         graphs.get_gcsa_kmers(kmer_size, edge_max, kmer_stride, kmers, 0);
         
-        // Handle finding the sink node
-        size_t sink_node_id = 0;
-        for(auto kmer : kmers) {
-            if(gcsa::Key::label(kmer.key) == 0) {
-                // This kmer lets us know the sink node.
-                sink_node_id = gcsa::Node::id(kmer.from);
-                break;
-            }
-        }
-        
-        for(auto& kmer : kmers) {
-            // Mark kmers that go to the sink node as "sorted", since they have stop
-            // characters in them and can't be extended.
-            // TODO: Can we just check for the presence of "$" during conversion and not do this serial loop?
-            if(gcsa::Node::id(kmer.to) == sink_node_id && gcsa::Node::offset(kmer.to) > 0) {
-                kmer.makeSorted();
-            }
-            
-            //cout << kmer << std::endl;
-        }
-        
         if(show_progress) {
             cerr << "Found " << kmers.size() << " kmer instances" << endl;
         }
@@ -2217,6 +2327,9 @@ int main_index(int argc, char** argv) {
         // this requires the index to be queryable
         //index.open_for_write(db_name);
         graphs.store_paths_in_index(index);
+        if (store_path_anchors) {
+            graphs.store_path_anchors_in_index(index);
+        }
         index.compact();
         index.flush();
         index.close();
@@ -2450,15 +2563,21 @@ void help_map(char** argv) {
          << "    -b, --hts-input FILE  align reads from htslib-compatible FILE (BAM/CRAM/SAM) stdin (-), alignments to stdout" << endl
          << "    -f, --fastq FILE      input fastq (possibly compressed), two are allowed, one for each mate" << endl
          << "    -i, --interleaved     fastq is interleaved paired-ended" << endl
-         << "    -p, --pair-window N   align to a graph up to N ids away from the mapping location of one mate for the other" << endl
+         << "    -p, --pair-window N   align to a graph up to N bases away from the mapping location of one mate for the other (default 700)" << endl
+         << "    -M, --fragment-model N  learn fragment lengths, in bases between the mates, and orientations from the first" << endl
+         << "                          N confidently aligned pairs, then look for mates where they say (default 100, 0 to disable)" << endl
         //<< "    -B, --try-both-mates  attempt to align both reads individually, then used paired end resolution to fix" << endl
          << "    -N, --sample NAME     for --reads input, add this sample" << endl
          << "    -R, --read-group NAME for --reads input, add this read group" << endl
-         << "    -k, --kmer-size N     use this kmer size, it must be < kmer size in db (default: from index)" << endl
+         << "    -k, --kmer-size N     use this kmer size, it must be < kmer size in db (default: the largest in the index)" << endl
          << "    -j, --kmer-stride N   step distance between succesive kmers to use for seeding (default: kmer size)" << endl
          << "    -E, --min-kmer-entropy N  require shannon entropy of this in order to use kmer (default: no limit)" << endl
-         << "    -S, --sens-step N     decrease kmer size by N bp until alignment succeeds (default: 5)" << endl
-         << "    -A, --max-attempts N  try to improve sensitivity and align this many times (default: 7)" << endl
+         << "    -u, --max-dust N      don't seed in read regions with a DUST score over N (default: no limit)" << endl
+         << "    -S, --sens-step N     below the smallest kmer size in the index, decrease kmer size by N bp when retrying (default: 3)" << endl
+         << "    -L, --kmer-min N      don't retry with kmers shorter than N, even sizes in the index (default: 11); below" << endl
+         << "                          that, retries only take kmers more densely, so lower it for more sensitivity" << endl
+         << "    -A, --max-attempts N  try to improve sensitivity and align this many times (default: 7), or fewer if" << endl
+         << "                          no other kmer size or stride looks any more likely to work" << endl
          << "    -x, --thread-ex N     grab this many neighboring nodes around each thread for alignment (default: 2)" << endl
          << "    -c, --clusters N      use at most the largest N ordered clusters of the kmer graph for alignment (default: all)" << endl
          << "    -C, --cluster-min N   require at least this many kmer hits in a cluster to attempt alignment (default: 2)" << endl
@@ -2466,9 +2585,11 @@ void help_map(char** argv) {
          << "    -t, --threads N       number of threads to use" << endl
          << "    -F, --prefer-forward  if the forward alignment of the read works, accept it" << endl
          << "    -G, --greedy-accept   if a tested alignment achieves -X score/bp don't try worse seeds" << endl
+         << "    -e, --no-exact-match  use the aligner even for reads whose kmers place them exactly" << endl
          << "    -X, --score-per-bp N  accept early alignment if the alignment score per base is > N and -F or -G is set" << endl
          << "    -J, --output-json     output JSON rather than an alignment stream (helpful for debugging)" << endl
-         << "    -B, --band-width N    for very long sequences, align in chunks then merge paths (default 1000bp)" << endl
+         << "    -B, --band-width N    align longer sequences by chaining sparse kmer hits, in pieces of at most N bp (default 1000bp)" << endl
+         << "                          each piece is aligned with full DP to the graph around the kmer hits on either side of it" << endl
          << "    -D, --debug           print debugging information about alignment to stderr" << endl;
 }
 
@@ -2485,6 +2606,7 @@ int main_map(int argc, char** argv) {
     int kmer_size = 0;
     int kmer_stride = 0;
     int sens_step = 0;
+    int kmer_min = 0;
     int best_clusters = 0;
     int cluster_min = 2;
     int max_attempts = 7;
@@ -2497,15 +2619,18 @@ int main_map(int argc, char** argv) {
     bool debug = false;
     bool prefer_forward = false;
     bool greedy_accept = false;
+    bool try_exact_match = true;
     float score_per_bp = 0;
     string sample_name;
     string read_group;
     string fastq1, fastq2;
     bool interleaved_fastq = false;
-    int pair_window = 64; // ~11bp/node
+    int pair_window = 700;
+    int fragment_model_size = 100;
     int band_width = 1000; // anything > 1000bp sequences is difficult to align efficiently
     bool try_both_mates_first = false;
     float min_kmer_entropy = 0;
+    float max_dust_score = 0;
 
     int c;
     optind = 2; // force optind past command positional argument
@@ -2520,6 +2645,7 @@ int main_map(int argc, char** argv) {
                 {"kmer-stride", required_argument, 0, 'j'},
                 {"kmer-size", required_argument, 0, 'k'},
                 {"min-kmer-entropy", required_argument, 0, 'E'},
+                {"max-dust", required_argument, 0, 'u'},
                 {"clusters", required_argument, 0, 'c'},
                 {"cluster-min", required_argument, 0, 'C'},
                 {"max-attempts", required_argument, 0, 'A'},
@@ -2530,21 +2656,24 @@ int main_map(int argc, char** argv) {
                 {"threads", required_argument, 0, 't'},
                 {"prefer-forward", no_argument, 0, 'F'},
                 {"greedy-accept", no_argument, 0, 'G'},
+                {"no-exact-match", no_argument, 0, 'e'},
                 {"score-per-bp", required_argument, 0, 'X'},
                 {"sens-step", required_argument, 0, 'S'},
+                {"kmer-min", required_argument, 0, 'L'},
                 {"thread-ex", required_argument, 0, 'x'},
                 {"output-json", no_argument, 0, 'J'},
                 {"hts-input", no_argument, 0, 'b'},
                 {"fastq", no_argument, 0, 'f'},
                 {"interleaved", no_argument, 0, 'i'},
                 {"pair-window", required_argument, 0, 'p'},
+                {"fragment-model", required_argument, 0, 'M'},
                 {"band-width", required_argument, 0, 'B'},
                 {"debug", no_argument, 0, 'D'},
                 {0, 0, 0, 0}
             };
 
         int option_index = 0;
-        c = getopt_long (argc, argv, "s:j:hd:c:r:m:k:t:DX:FS:Jb:R:N:if:p:B:x:GC:A:E:Q:",
+        c = getopt_long (argc, argv, "s:j:hd:c:r:m:k:t:DX:FS:L:Jb:R:N:if:p:M:B:x:GeC:A:E:Q:u:",
                          long_options, &option_index);
         
         /* Detect the end of the options. */
@@ -2577,6 +2706,10 @@ int main_map(int argc, char** argv) {
             sens_step = atoi(optarg);
             break;
 
+        case 'L':
+            kmer_min = atoi(optarg);
+            break;
+
         case 'c':
             best_clusters = atoi(optarg);
             break;
@@ -2589,6 +2722,10 @@ int main_map(int argc, char** argv) {
             min_kmer_entropy = atof(optarg);
             break;
 
+        case 'u':
+            max_dust_score = atof(optarg);
+            break;
+
         case 'A':
             max_attempts = atoi(optarg);
             break;
@@ -2631,6 +2768,10 @@ int main_map(int argc, char** argv) {
             pair_window = atoi(optarg);
             break;
 
+        case 'M':
+            fragment_model_size = atoi(optarg);
+            break;
+
         case 't':
             omp_set_num_threads(atoi(optarg));
             break;
@@ -2647,6 +2788,10 @@ int main_map(int argc, char** argv) {
             greedy_accept = true;
             break;
 
+        case 'e':
+            try_exact_match = false;
+            break;
+
         case 'X':
             score_per_bp = atof(optarg);
             break;
@@ -2696,6 +2841,8 @@ int main_map(int argc, char** argv) {
     mapper.resize(thread_count);
     vector<vector<Alignment> > output_buffer;
     output_buffer.resize(thread_count);
+    // each thread compresses its own buffer, and one at a time writes them out
+    stream::ChunkWriter<Alignment> output_writer(cout);
 
     Index idx;
     idx.open_read_only(db_name);
@@ -2707,12 +2854,16 @@ int main_map(int argc, char** argv) {
         m->debug = debug;
         if (score_per_bp) m->target_score_per_bp = score_per_bp;
         if (sens_step) m->kmer_sensitivity_step = sens_step;
+        if (kmer_min) m->kmer_min = kmer_min;
         m->prefer_forward = prefer_forward;
         m->greedy_accept = greedy_accept;
+        m->try_exact_match = try_exact_match;
         m->thread_extension = thread_ex;
         m->cluster_min = cluster_min;
         m->max_attempts = max_attempts;
         m->min_kmer_entropy = min_kmer_entropy;
+        m->max_dust_score = max_dust_score;
+        m->fragment_model_size = fragment_model_size;
         mapper[i] = m;
     }
 
@@ -2756,8 +2907,9 @@ int main_map(int argc, char** argv) {
                         cout << json2 << "\n";
                     } else {
                         auto& output_buf = output_buffer[tid];
-                        output_buf.push_back(alignment);
-                        stream::write_buffered(cout, output_buf, 1000);
+                        output_buf.emplace_back();
+                        output_buf.back().Swap(&alignment);
+                        output_writer.write_buffered(output_buf, 1000);
                     }
                 }
             }
@@ -2768,21 +2920,23 @@ int main_map(int argc, char** argv) {
         function<void(Alignment&)> lambda =
             [&mapper,
              &output_buffer,
+             &output_writer,
              &output_json,
              &kmer_size,
              &kmer_stride,
              &band_width]
             (Alignment& alignment) {
             int tid = omp_get_thread_num();
-            alignment = mapper[tid]->align(alignment, kmer_size, kmer_stride, band_width);
+            Alignment aligned = mapper[tid]->align(alignment, kmer_size, kmer_stride, band_width);
             if (output_json) {
-                string json2 = pb2json(alignment);
+                string json2 = pb2json(aligned);
 #pragma omp critical (cout)
                 cout << json2 << "\n";
             } else {
                 auto& output_buf = output_buffer[tid];
-                output_buf.push_back(alignment);
-                stream::write_buffered(cout, output_buf, 1000);
+                output_buf.emplace_back();
+                output_buf.back().Swap(&aligned);
+                output_writer.write_buffered(output_buf, 1000);
             }
         };
         // run
@@ -2795,6 +2949,7 @@ int main_map(int argc, char** argv) {
             function<void(Alignment&, Alignment&)> lambda =
                 [&mapper,
                  &output_buffer,
+                 &output_writer,
                  &output_json,
                  &kmer_size,
                  &kmer_stride,
@@ -2810,9 +2965,11 @@ int main_map(int argc, char** argv) {
                     cout << json1 << "\n" << json2 << "\n";
                 } else {
                     auto& output_buf = output_buffer[tid];
-                    output_buf.push_back(alnp.first);
-                    output_buf.push_back(alnp.second);
-                    stream::write_buffered(cout, output_buf, 1000);
+                    output_buf.emplace_back();
+                    output_buf.back().Swap(&alnp.first);
+                    output_buf.emplace_back();
+                    output_buf.back().Swap(&alnp.second);
+                    output_writer.write_buffered(output_buf, 1000);
                 }
             };
             fastq_paired_interleaved_for_each_parallel(fastq1, lambda);
@@ -2821,21 +2978,23 @@ int main_map(int argc, char** argv) {
             function<void(Alignment&)> lambda =
                 [&mapper,
                  &output_buffer,
+                 &output_writer,
                  &output_json,
                  &kmer_size,
                  &kmer_stride,
                  &band_width]
                 (Alignment& alignment) {
                 int tid = omp_get_thread_num();
-                alignment = mapper[tid]->align(alignment, kmer_size, kmer_stride, band_width);
+                Alignment aligned = mapper[tid]->align(alignment, kmer_size, kmer_stride, band_width);
                 if (output_json) {
-                    string json2 = pb2json(alignment);
+                    string json2 = pb2json(aligned);
 #pragma omp critical (cout)
                     cout << json2 << "\n";
                 } else {
                     auto& output_buf = output_buffer[tid];
-                    output_buf.push_back(alignment);
-                    stream::write_buffered(cout, output_buf, 1000);
+                    output_buf.emplace_back();
+                    output_buf.back().Swap(&aligned);
+                    output_writer.write_buffered(output_buf, 1000);
                 }
             };
             fastq_unpaired_for_each_parallel(fastq1, lambda);
@@ -2844,6 +3003,7 @@ int main_map(int argc, char** argv) {
             function<void(Alignment&, Alignment&)> lambda =
                 [&mapper,
                  &output_buffer,
+                 &output_writer,
                  &output_json,
                  &kmer_size,
                  &kmer_stride,
@@ -2859,9 +3019,11 @@ int main_map(int argc, char** argv) {
                     cout << json1 << "\n" << json2 << "\n";
                 } else {
                     auto& output_buf = output_buffer[tid];
-                    output_buf.push_back(alnp.first);
-                    output_buf.push_back(alnp.second);
-                    stream::write_buffered(cout, output_buf, 1000);
+                    output_buf.emplace_back();
+                    output_buf.back().Swap(&alnp.first);
+                    output_buf.emplace_back();
+                    output_buf.back().Swap(&alnp.second);
+                    output_writer.write_buffered(output_buf, 1000);
                 }
             };
             fastq_paired_two_files_for_each_parallel(fastq1, fastq2, lambda);
@@ -2873,9 +3035,10 @@ int main_map(int argc, char** argv) {
         delete mapper[i];
         auto& output_buf = output_buffer[i];
         if (!output_json) {
-            stream::write_buffered(cout, output_buf, 0);
+            output_writer.write_buffered(output_buf, 0);
         }
     }
+    output_writer.flush();
 
     cout.flush();
 
@@ -3288,6 +3451,8 @@ void help_construct(char** argv) {
          << "    -z, --region-size N   variants per region to parallelize" << endl
          << "    -m, --node-max N      limit the maximum allowable node sequence size" << endl
          << "                          nodes greater than this threshold will be divided" << endl
+         << "    -S, --streaming       write the graph out chunk by chunk as it is built, using" << endl
+         << "                          bounded memory (node ids then depend on the region size)" << endl
          << "    -p, --progress        show progress" << endl
          << "    -t, --threads N       use N threads to construct graph (defaults to numCPUs)" << endl;
 }
@@ -3307,6 +3472,7 @@ int main_construct(int argc, char** argv) {
     int vars_per_region = 25000;
     int max_node_size = 0;
     string ref_paths_file;
+    bool streaming = false;
 
     int c;
     while (true) {
@@ -3323,11 +3489,12 @@ int main_construct(int argc, char** argv) {
                 {"region", required_argument, 0, 'R'},
                 {"region-is-chrom", no_argument, 0, 'C'},
                 {"node-max", required_argument, 0, 'm'},
+                {"streaming", no_argument, 0, 'S'},
                 {0, 0, 0, 0}
             };
 
         int option_index = 0;
-        c = getopt_long (argc, argv, "v:r:phz:t:R:m:P:s:C",
+        c = getopt_long (argc, argv, "v:r:phz:t:R:m:P:s:CS",
                          long_options, &option_index);
         
         /* Detect the end of the options. */
@@ -3371,6 +3538,10 @@ int main_construct(int argc, char** argv) {
         case 'm':
             max_node_size = atoi(optarg);
             break;
+
+        case 'S':
+            streaming = true;
+            break;
             
         case 'h':
         case '?':
@@ -3400,6 +3571,29 @@ int main_construct(int argc, char** argv) {
     }
     reference.open(fasta_file_name);
 
+    if (streaming) {
+        VG graph;
+        graph.show_progress = progress;
+        ofstream paths_out;
+        if (!ref_paths_file.empty()) {
+            paths_out.open(ref_paths_file);
+        }
+        stream::ChunkWriter<Graph> writer(std::cout, true);
+        stream::ChunkWriter<Path> paths_writer(paths_out, true);
+        function<void(Graph&, uint64_t)> emit = [&](Graph& chunk, uint64_t chunk_id) {
+            if (!ref_paths_file.empty()) {
+                vector<Path> chunk_paths(chunk.path().begin(), chunk.path().end());
+                paths_writer.write(chunk_paths, chunk_id);
+            }
+            vector<Graph> chunk_buf(1);
+            chunk_buf.back().Swap(&chunk);
+            writer.write(chunk_buf, chunk_id);
+        };
+        graph.construct_streaming(variant_file, reference, region, region_is_chrom,
+                                  vars_per_region, max_node_size, emit);
+        return 0;
+    }
+
     // store our reference sequence paths
     Paths ref_paths;
 
@@ -19,8 +19,18 @@ Mapper::Mapper(Index* idex, gcsa::GCSA* g)
     , softclip_threshold(0)
     , prefer_forward(false)
     , greedy_accept(false)
+    , try_exact_match(true)
     , target_score_per_bp(1.5)
     , min_kmer_entropy(0)
+    , max_dust_score(0)
+    , dust_window(64)
+    , fragment_model_size(100)
+    , fragment_sigma(4)
+    , discordant_pair_penalty(20)
+    , fragment_same_strand(0)
+    , fragment_length_mean(0)
+    , fragment_length_stdev(0)
+    , max_mapping_quality(60)
     , debug(false)
 {
     kmer_sizes = index->stored_kmer_sizes();
@@ -45,22 +55,120 @@ Alignment Mapper::align(string& seq, int kmer_size, int stride, int band_width)
 // align read2 near read1's mapping location
 void Mapper::align_mate_in_window(Alignment& read1, Alignment& read2, int pair_window) {
     if (read1.score() == 0) return; // bail out if we haven't aligned the first
-    // try to recover in region
-    Path* path = read1.mutable_path();
-    int64_t idf = path->mutable_mapping(0)->position().node_id();
-    int64_t idl = path->mutable_mapping(path->mapping_size()-1)->position().node_id();
+    // try to recover in the graph within pair_window bases of where it mapped
     // but which way should we expand? this will make things much easier
     // just use the whole "window" for now
-    int64_t first = max((int64_t)0, idf - pair_window);
-    int64_t last = idl + (int64_t) pair_window;
+    set<int64_t> ids;
+    for (auto& mapping : read1.path().mapping()) {
+        ids.insert(mapping.position().node_id());
+    }
     VG* graph = new VG;
-    index->get_range(first, last, *graph);
+    index->get_context_within(ids, pair_window, *graph);
     graph->remove_orphan_edges();
     read2.clear_path();
     read2.set_score(0);
     
     graph->align(read2);
     delete graph;
+    // a mate found near the other is placed about as surely as the other is
+    if (read2.score()) read2.set_mapping_quality(read1.mapping_quality());
+}
+
+bool Mapper::fragment_model_ready(void) {
+    return fragment_model_size > 0 && fragment_lengths.size() >= fragment_model_size;
+}
+
+int64_t Mapper::fragment_length(const Alignment& aln1, const Alignment& aln2, int64_t max_length) {
+    set<int64_t> ids1, ids2;
+    for (auto& mapping : aln1.path().mapping()) ids1.insert(mapping.position().node_id());
+    for (auto& mapping : aln2.path().mapping()) ids2.insert(mapping.position().node_id());
+    return index->get_distance_within(ids1, ids2, max_length);
+}
+
+void Mapper::record_fragment(const Alignment& aln1, const Alignment& aln2, int pair_window) {
+    if (fragment_model_size == 0 || fragment_model_ready()) return;
+    // only learn from pairs where both mates align confidently
+    for (auto* aln : { &aln1, &aln2 }) {
+        if (aln->score() == 0 || aln->path().mapping_size() == 0
+            || (float)aln->score() / (float)aln->sequence().size() < target_score_per_bp) {
+            return;
+        }
+    }
+    // and that are near enough to be a pair
+    int64_t length = fragment_length(aln1, aln2, pair_window);
+    if (length < 0) return;
+    fragment_lengths.push_back(length);
+    if (aln1.is_reverse() == aln2.is_reverse()) ++fragment_same_strand;
+    if (fragment_model_ready()) {
+        double sum = 0;
+        for (auto length : fragment_lengths) sum += length;
+        fragment_length_mean = sum / fragment_lengths.size();
+        double var = 0;
+        for (auto length : fragment_lengths) {
+            var += (length - fragment_length_mean) * (length - fragment_length_mean);
+        }
+        fragment_length_stdev = sqrt(var / fragment_lengths.size());
+        if (debug) cerr << "fragment model: length " << fragment_length_mean
+                        << " sd " << fragment_length_stdev << ", "
+                        << fragment_same_strand << "/" << fragment_lengths.size()
+                        << " on the same strand" << endl;
+    }
+}
+
+double Mapper::fragment_length_slack(void) {
+    // allow a base either way, so a model learned from pairs that all land
+    // the same distance apart isn't too strict
+    return max(1.0, fragment_sigma * fragment_length_stdev);
+}
+
+bool Mapper::pair_consistent(const Alignment& aln1, const Alignment& aln2) {
+    if (aln1.score() == 0 || aln2.score() == 0
+        || aln1.path().mapping_size() == 0 || aln2.path().mapping_size() == 0) {
+        return false;
+    }
+    if (!fragment_model_ready()) return true;
+    bool same_strand = fragment_same_strand * 2 > (int) fragment_lengths.size();
+    if ((aln1.is_reverse() == aln2.is_reverse()) != same_strand) return false;
+    double allowed = fragment_length_slack();
+    int64_t length = fragment_length(aln1, aln2, ceil(fragment_length_mean + allowed));
+    return length >= 0 && fabs(length - fragment_length_mean) <= allowed;
+}
+
+int Mapper::pair_score(const Alignment& aln1, const Alignment& aln2) {
+    return aln1.score() + aln2.score()
+        - (pair_consistent(aln1, aln2) ? 0 : discordant_pair_penalty);
+}
+
+int Mapper::fragment_window(int mate_length) {
+    // the mate's nodes start up to the longest expected fragment length away,
+    // and run on for up to its length past that
+    return ceil(fragment_length_mean + fragment_length_slack()) + mate_length;
+}
+
+void Mapper::orient_mate(const Alignment& aln1, Alignment& read2) {
+    bool same_strand = fragment_same_strand * 2 > (int) fragment_lengths.size();
+    if (aln1.is_reverse() == same_strand) {
+        read2.set_sequence(reverse_complement(read2.sequence()));
+        read2.set_is_reverse(!read2.is_reverse());
+    }
+}
+
+void Mapper::rescue_mate(Alignment& aln1, Alignment& read2, int pair_window) {
+    if (fragment_model_ready()) {
+        orient_mate(aln1, read2);
+        align_mate_in_window(aln1, read2, pair_window);
+        return;
+    }
+    // until the model is ready we don't know which strand the mate is on
+    // relative to the first, so try both and keep the better
+    Alignment reversed = read2;
+    reversed.set_sequence(reverse_complement(read2.sequence()));
+    reversed.set_is_reverse(!read2.is_reverse());
+    align_mate_in_window(aln1, read2, pair_window);
+    align_mate_in_window(aln1, reversed, pair_window);
+    if (reversed.score() > read2.score()) {
+        read2.Swap(&reversed);
+    }
 }
 
 pair<Alignment, Alignment> Mapper::align_paired(Alignment& read1, Alignment& read2, int kmer_size, int stride, int band_width, int pair_window) {
@@ -69,76 +177,271 @@ pair<Alignment, Alignment> Mapper::align_paired(Alignment& read1, Alignment& rea
     //
     // attempt mapping of first mate
     // if it works, expand the search space for the second (try to avoid new kmer lookups)
-    //     (alternatively, do the whole kmer lookup thing but then restrict the constructed
-    //      graph to a range near the first alignment)
     // if it doesn't work, try the second, then expand the range to align the first
     //
-    // problem: need to develop model of pair orientations
-    // solution: collect a buffer of alignments and then align them using unpaired approach
-    //           detect read orientation and mean (and sd) of pair distance
+    // the pair orientations and distances come from the fragment model, which
+    // is built from the first pairs we map with the unpaired approach
 
-    //if (try_both_first) {
     Alignment aln1 = align(read1, kmer_size, stride, band_width);
-    Alignment aln2 = align(read2, kmer_size, stride, band_width);
+    Alignment aln2;
+    bool have_mate = false;
+    if (fragment_model_ready() && aln1.score()) {
+        // look for the second mate where the model says it should be
+        aln2 = read2;
+        orient_mate(aln1, aln2);
+        align_mate_in_window(aln1, aln2, fragment_window(aln2.sequence().size()));
+        // if it's there and good, we don't need to seed it at all
+        have_mate = (float)aln2.score() / (float)aln2.sequence().size() >= target_score_per_bp
+            && pair_consistent(aln1, aln2);
+        if (debug && have_mate) cerr << "found mate near first read" << endl;
+    }
+    if (!have_mate) {
+        Alignment seeded = align(read2, kmer_size, stride, band_width);
+        if (aln2.sequence().empty() || pair_score(aln1, seeded) > pair_score(aln1, aln2)) {
+            aln2.Swap(&seeded);
+        }
+    }
+
+    // learn from pairs that both aligned on their own
+    record_fragment(aln1, aln2, pair_window);
+
+    // and then try to rescue unmapped mates
+    if (aln1.score() == 0 && aln2.score()) {
+        aln1 = read1;
+        rescue_mate(aln2, aln1, fragment_model_ready() ? fragment_window(aln1.sequence().size()) : pair_window);
+    } else if (aln2.score() == 0 && aln1.score() && !fragment_model_ready()) {
+        aln2 = read2;
+        rescue_mate(aln1, aln2, pair_window);
+    }
+
+    // mark them as discordant if they don't fit the model
+    if (fragment_model_ready() && aln1.score() && aln2.score() && !pair_consistent(aln1, aln2)) {
+        aln1.set_discordant_pair(true);
+        aln2.set_discordant_pair(true);
+    }
+
     // link the fragments
     aln1.mutable_fragment_next()->set_name(aln2.name());
     aln2.mutable_fragment_prev()->set_name(aln1.name());
-    // and then try to rescue unmapped mates
-    if (aln1.score() == 0 && aln2.score()) {
-        // should we reverse the read??
-        if (aln2.is_reverse()) {
-            aln1.set_sequence(reverse_complement(aln1.sequence()));
-            aln1.set_is_reverse(true);
+    pair<Alignment, Alignment> results;
+    results.first.Swap(&aln1);
+    results.second.Swap(&aln2);
+    return results;
+
+}
+
+Alignment Mapper::align_banded(Alignment& read, int kmer_size, int stride, int band_width) {
+    // if kmer size is not specified, pick it up from the index
+    if (kmer_size == 0) kmer_size = *kmer_sizes.begin();
+    // seed sparsely, with kmers that don't overlap
+    if (stride == 0) stride = kmer_size;
+
+    // seed each strand in one pass over the whole read, and chain the hits
+    Alignment alignment_f = read;
+    Alignment alignment_r = read;
+    alignment_r.set_sequence(reverse_complement(read.sequence()));
+    alignment_r.set_is_reverse(true);
+    vector<KmerAnchor> chain_f, chain_r;
+    find_anchors(alignment_f.sequence(), kmer_size, stride, chain_f);
+    find_anchors(alignment_r.sequence(), kmer_size, stride, chain_r);
+    chain_anchors(chain_f);
+    chain_anchors(chain_r);
+    if (debug) cerr << "long read chains " << chain_f.size() << " forward, "
+                    << chain_r.size() << " reverse" << endl;
+
+    bool forward = chain_f.size() >= chain_r.size();
+    Alignment& alignment = forward ? alignment_f : alignment_r;
+    vector<KmerAnchor>& chain = forward ? chain_f : chain_r;
+    alignment.clear_path();
+    alignment.set_score(0);
+    if (chain.empty()) {
+        if (debug) cerr << "failed alignment" << endl;
+        return alignment;
+    }
+    const string& sequence = alignment.sequence();
+
+    // Cut the read into pieces of at most band_width bases, at anchors where
+    // we can, and align each piece in the part of the graph around the
+    // anchors on either side of it, as far out from each as the piece
+    // reaches in the read, with max_thread_gap bases to spare for deletions.
+    // Each piece is aligned to all of that graph, not in a band.
+    Path* path = alignment.mutable_path();
+    string unaligned; // sequence we couldn't place, waiting for a mapping
+    int score = 0;
+    int start = 0;
+    size_t next = 0; // first anchor after start
+    while (start < sequence.size()) {
+        int end = min((int) sequence.size(), start + band_width);
+        while (next < chain.size() && chain[next].read_offset <= start) ++next;
+        if (end < sequence.size()) {
+            // end the piece at the last anchor that fits in it, if any do
+            size_t last = next;
+            while (last < chain.size() && chain[last].read_offset < end) ++last;
+            if (last > next) end = chain[last-1].read_offset;
         }
-        align_mate_in_window(aln2, aln1, pair_window);
-    } else if (aln2.score() == 0 && aln1.score()) {
-        if (aln1.is_reverse()) {
-            aln2.set_sequence(reverse_complement(aln2.sequence()));
-            aln2.set_is_reverse(true);
+        // the anchors bracketing the piece, or the ends of the chain where
+        // the piece runs past them
+        size_t after = next;
+        while (after < chain.size() && chain[after].read_offset < end) ++after;
+        const KmerAnchor& before_anchor = next > 0 ? chain[next-1] : chain.front();
+        const KmerAnchor& after_anchor = after < chain.size() ? chain[after] : chain.back();
+
+        VG graph;
+        for (auto* anchor : { &before_anchor, &after_anchor }) {
+            int reach = max(abs(anchor->read_offset - start), abs(end - anchor->read_offset));
+            index->get_context_within({ anchor->node_id }, reach + max_thread_gap, graph);
         }
-        align_mate_in_window(aln1, aln2, pair_window);
+        graph.remove_orphan_edges();
+        if (debug) cerr << "aligning " << start << "-" << end
+                        << " around nodes " << before_anchor.node_id << " and " << after_anchor.node_id
+                        << " in " << graph.node_count() << " nodes" << endl;
+
+        Alignment piece;
+        piece.set_sequence(sequence.substr(start, end - start));
+        graph.align(piece);
+
+        if (piece.has_path() && piece.path().mapping_size() > 0) {
+            Path* piece_path = piece.mutable_path();
+            if (!unaligned.empty()) {
+                // what we couldn't align before goes in at the start of this
+                Mapping* mapping = piece_path->mutable_mapping(0);
+                Edit* edit = mapping->add_edit();
+                edit->set_to_length(unaligned.size());
+                edit->set_sequence(unaligned);
+                for (int i = mapping->edit_size() - 1; i > 0; --i) {
+                    mapping->mutable_edit()->SwapElements(i, i-1);
+                }
+                unaligned.clear();
+            }
+            append_path(*path, *piece_path);
+            score += piece.score();
+        } else if (path->mapping_size() > 0) {
+            // or at the end of what we have so far
+            Edit* edit = path->mutable_mapping(path->mapping_size()-1)->add_edit();
+            edit->set_to_length(piece.sequence().size());
+            edit->set_sequence(piece.sequence());
+        } else {
+            unaligned += piece.sequence();
+        }
+        start = end;
     }
-    // TODO
-    // mark them as discordant if there is an issue?
-    // this needs to be detected with care using statistics built up from a bunch of reads
-    return make_pair(aln1, aln2);
 
+    if (path->mapping_size() == 0) {
+        if (debug) cerr << "failed alignment" << endl;
+        alignment.clear_path();
+        return alignment;
+    }
+    alignment.set_score(score);
+    alignment.set_query_position(0);
+    // how much better the chain is than the one on the other strand, as the
+    // score of the bases its extra kmers cover
+    int match_score = 2; // the aligner's default
+    vector<KmerAnchor>& other = forward ? chain_r : chain_f;
+    alignment.set_mapping_quality(
+        compute_mapping_quality(match_score * kmer_size * chain.size(),
+                                match_score * kmer_size * other.size()));
+    return alignment;
 }
 
-Alignment Mapper::align_banded(Alignment& read, int kmer_size, int stride, int band_width) {
-    // split the alignment up into overlapping chunks of band_width size
-    list<Alignment> alignments;
-    assert(read.sequence().size() > band_width);
-    int div = 2;
-    while (read.sequence().size()/div > band_width) {
-        ++div;
-    }
-    int segment_size = read.sequence().size()/div;
-    // and overlap them too
-    Alignment merged;
-    for (int i = 0; i < div; ++i) {
-        {
-            Alignment aln = read;
-            if (i+1 == div) {
-                // ensure we get all the sequence
-                aln.set_sequence(read.sequence().substr(i*segment_size));
-            } else {
-                aln.set_sequence(read.sequence().substr(i*segment_size, segment_size));
+void Mapper::find_anchors(const string& sequence, int kmer_size, int stride, vector<KmerAnchor>& anchors) {
+    auto kmers = balanced_kmers(sequence, kmer_size, stride);
+    int kmer_step = balanced_stride(sequence.size(), kmer_size, stride);
+    int kmer_offset = -kmer_step;
+    vector<bool> low_complexity;
+    find_low_complexity(sequence, kmer_size, low_complexity);
+    map<int64_t, vector<int32_t> > kmer_positions;
+    for (auto& k : kmers) {
+        kmer_offset += kmer_step;
+        // the same filters as for short reads
+        if (!allATGC(k)) continue;
+        if (low_complexity[kmer_offset]) continue;
+        if (index->approx_size_of_kmer_matches(k) > hit_size_threshold) continue;
+        kmer_positions.clear();
+        index->get_kmer_positions(k, kmer_positions);
+        if (kmer_positions.size() > hit_max) continue;
+        for (auto& p : kmer_positions) {
+            for (auto& offset : p.second) {
+                anchors.push_back(KmerAnchor{kmer_offset, p.first, offset});
             }
-            if (i == 0) {
-                merged = align(aln, kmer_size, stride);
+        }
+    }
+}
+
+void Mapper::chain_anchors(vector<KmerAnchor>& anchors) {
+    if (anchors.empty()) return;
+    sort(anchors.begin(), anchors.end(), [](const KmerAnchor& a, const KmerAnchor& b) {
+            return make_tuple(a.read_offset, a.node_id, a.node_offset)
+                < make_tuple(b.read_offset, b.node_id, b.node_offset);
+        });
+    // How many kmers of the read back we look for anchors to chain from.
+    // Bounding this keeps chaining linear in the length of the read. We count
+    // kmers, not anchors, so a kmer with many hits can't fill the window.
+    int lookback = 16;
+    // where the anchors of each kmer of the read start, in read order, and
+    // which of those kmers each anchor is from
+    vector<int> kmer_starts;
+    vector<int> kmer_rank(anchors.size());
+    for (int j = 0; j < anchors.size(); ++j) {
+        if (j == 0 || anchors[j].read_offset != anchors[j-1].read_offset) {
+            kmer_starts.push_back(j);
+        }
+        kmer_rank[j] = kmer_starts.size() - 1;
+    }
+    vector<int> length(anchors.size(), 1);
+    vector<int> previous(anchors.size(), -1);
+    int best = 0;
+    for (int j = 0; j < anchors.size(); ++j) {
+        auto& b = anchors[j];
+        // the anchors of the lookback kmers before this one's
+        int first = kmer_starts[max(0, kmer_rank[j] - lookback)];
+        int last = kmer_starts[kmer_rank[j]];
+        // Find how far the nodes of the anchors we might chain from are from
+        // this one's in the graph, in one search out to the farthest of them.
+        // The search follows edges both ways, so this is a distance and not a
+        // direction: we don't check that the link goes forward in the graph,
+        // only in the read. The pieces between the anchors are aligned to the
+        // graph around both of them, so a link the wrong way can't make the
+        // alignment itself go backwards.
+        set<int64_t> targets;
+        int reach = 0;
+        for (int i = first; i < last; ++i) {
+            if (anchors[i].node_id != b.node_id) targets.insert(anchors[i].node_id);
+            reach = max(reach, b.read_offset - anchors[i].read_offset);
+        }
+        map<int64_t, int64_t> distance;
+        if (!targets.empty()) {
+            VG graph;
+            index->for_each_node_within({ b.node_id }, reach + max_thread_gap, graph,
+                                        [&targets, &distance](int64_t id, int64_t d) {
+                                            if (targets.count(id)) distance[id] = d;
+                                            return distance.size() < targets.size();
+                                        });
+        }
+        for (int i = last - 1; i >= first; --i) {
+            auto& a = anchors[i];
+            int read_gap = b.read_offset - a.read_offset;
+            // the anchors can't be farther apart in the graph than in the
+            // read, give or take max_thread_gap bases for deletions
+            if (b.node_id == a.node_id) {
+                if (b.node_offset <= a.node_offset
+                    || b.node_offset - a.node_offset > read_gap + max_thread_gap) continue;
             } else {
-                merge_alignments(merged, align(aln, kmer_size, stride));
+                auto d = distance.find(a.node_id);
+                if (d == distance.end() || d->second > read_gap + max_thread_gap) continue;
+            }
+            if (length[i] + 1 > length[j]) {
+                length[j] = length[i] + 1;
+                previous[j] = i;
             }
         }
-        // and the overlapped bit --- here we're using 50% overlap
-        if (i != div-1) { // if we're not at the last sequence
-            Alignment aln = read;
-            aln.set_sequence(read.sequence().substr(i*segment_size+segment_size/2, segment_size));
-            merge_alignments(merged, align(aln, kmer_size, stride));
-        }
+        if (length[j] > length[best]) best = j;
+    }
+    // keep the longest chain
+    vector<KmerAnchor> chain(length[best]);
+    for (int j = best, k = length[best] - 1; j != -1; j = previous[j], --k) {
+        chain[k] = anchors[j];
     }
-    return merged;
+    anchors.swap(chain);
 }
 
 Alignment Mapper::align(Alignment& aln, int kmer_size, int stride, int band_width) {
@@ -152,13 +455,17 @@ Alignment Mapper::align(Alignment& aln, int kmer_size, int stride, int band_widt
     const string& sequence = aln.sequence();
 
     // if kmer size is not specified, pick it up from the index
-    // for simplicity, use the first available kmer size; this could change
-    if (kmer_size == 0) kmer_size = *kmer_sizes.begin();
+    // start with the largest, which should have the fewest hits to look through
+    if (kmer_size == 0) kmer_size = *kmer_sizes.rbegin();
     // and start with stride such that we barely cover the read with kmers
     if (stride == 0)
         stride = sequence.size()
             / ceil((double)sequence.size() / kmer_size);
 
+    // kmers looked up for one attempt are remembered for the rest
+    kmer_hit_cache.clear();
+    oversized_kmers.clear();
+
     int kmer_hit_count = 0;
     int kept_kmer_count = 0;
 
@@ -172,37 +479,21 @@ Alignment Mapper::align(Alignment& aln, int kmer_size, int stride, int band_widt
     alignment_r.set_sequence(reverse_complement(aln.sequence()));
     alignment_r.set_is_reverse(true);
 
-    auto increase_sensitivity = [this,
-                                 &kmer_size,
-                                 &stride,
-                                 &sequence,
-                                 &alignment_f,
-                                 &alignment_r]() {
-        kmer_size -= kmer_sensitivity_step;
-        stride = sequence.size() / ceil((double)sequence.size() / kmer_size);
-        if (debug) cerr << "realigning with " << kmer_size << " " << stride << endl;
-        /*
-        if ((double)stride/kmer_size < 0.5 && kmer_size -5 >= kmer_min) {
-            kmer_size -= 5;
-            stride = sequence.size() / ceil((double)sequence.size() / kmer_size);
-            if (debug) cerr << "realigning with " << kmer_size << " " << stride << endl;
-        } else if ((double)stride/kmer_size >= 0.5 && kmer_size >= kmer_min) {
-            stride = max(1, stride/3);
-            if (debug) cerr << "realigning with " << kmer_size << " " << stride << endl;
-        }
-        */
-    };
-
     int attempt = 0;
     int kmer_count_f = 0;
     int kmer_count_r = 0;
+    int second_best_f = 0;
+    int second_best_r = 0;
+    SeedStats seeds;
 
     while (alignment_f.score() == 0 && alignment_r.score() == 0 && attempt < max_attempts) {
 
+        seeds = SeedStats();
+
         {
             std::chrono::time_point<std::chrono::system_clock> start, end;
             if (debug) start = std::chrono::system_clock::now();
-            align_threaded(alignment_f, kmer_count_f, kmer_size, stride, attempt);
+            align_threaded(alignment_f, kmer_count_f, second_best_f, seeds, kmer_size, stride, attempt);
             if (debug) {
                 end = std::chrono::system_clock::now();
                 std::chrono::duration<double> elapsed_seconds = end-start;
@@ -210,11 +501,13 @@ Alignment Mapper::align(Alignment& aln, int kmer_size, int stride, int band_widt
             }
         }
 
-        if (!(prefer_forward && (float)alignment_f.score() / (float)sequence.size() >= target_score_per_bp))
+        // nothing on the other strand can beat a perfect match
+        if (!(prefer_forward && (float)alignment_f.score() / (float)sequence.size() >= target_score_per_bp)
+            && alignment_f.score() < exact_match_score(sequence))
         {
             std::chrono::time_point<std::chrono::system_clock> start, end;
             if (debug) start = std::chrono::system_clock::now();
-            align_threaded(alignment_r, kmer_count_r, kmer_size, stride, attempt);
+            align_threaded(alignment_r, kmer_count_r, second_best_r, seeds, kmer_size, stride, attempt);
             if (debug) {
                 end = std::chrono::system_clock::now();
                 std::chrono::duration<double> elapsed_seconds = end-start;
@@ -225,7 +518,11 @@ Alignment Mapper::align(Alignment& aln, int kmer_size, int stride, int band_widt
         ++attempt;
 
         if (alignment_f.score() == 0 && alignment_r.score() == 0) {
-            increase_sensitivity();
+            if (!plan_seeds(seeds, sequence.size(), kmer_size, stride)) {
+                if (debug) cerr << "no seeds left worth trying" << endl;
+                break;
+            }
+            if (debug) cerr << "realigning with " << kmer_size << " " << stride << endl;
         } else {
             break;
         }
@@ -238,14 +535,19 @@ Alignment Mapper::align(Alignment& aln, int kmer_size, int stride, int band_widt
         cerr << elapsed_seconds.count() << "\t" << "b" << "\t" << sequence << endl;
     }
 
-    if (alignment_r.score() > alignment_f.score()) {
-        return alignment_r;
-    } else {
-        return alignment_f;
-    }
+    // hand back the better of the two by swapping rather than copying
+    // the best on the other strand is another place the read could go
+    bool reverse_better = alignment_r.score() > alignment_f.score();
+    int second_best = reverse_better
+        ? max(second_best_r, alignment_f.score())
+        : max(second_best_f, alignment_r.score());
+    Alignment best;
+    best.Swap(reverse_better ? &alignment_r : &alignment_f);
+    best.set_mapping_quality(compute_mapping_quality(best.score(), second_best));
+    return best;
 }
 
-Alignment& Mapper::align_threaded(Alignment& alignment, int& kmer_count, int kmer_size, int stride, int attempt) {
+Alignment& Mapper::align_threaded(Alignment& alignment, int& kmer_count, int& second_best, SeedStats& seeds, int kmer_size, int stride, int attempt) {
 
     // parameters, some of which should probably be modifiable
     // TODO -- move to Mapper object
@@ -265,27 +567,43 @@ Alignment& Mapper::align_threaded(Alignment& alignment, int& kmer_count, int kme
 
     // Holds the map from node ID to collection of start offsets, one per kmer we're searching for.
     vector<map<int64_t, vector<int32_t> > > positions(kmers.size());
+    // Where in the read the kmer whose positions are in each slot starts
+    vector<int> kmer_offsets(kmers.size());
+    // how many kmers were dropped for having too many hits before this pass
+    int repetitive = seeds.repetitive;
+    int kmer_step = balanced_stride(sequence.size(), kmer_size, stride);
+    int kmer_offset = -kmer_step;
+    vector<bool> low_complexity;
+    find_low_complexity(sequence, kmer_size, low_complexity);
     int i = 0;
     for (auto& k : kmers) {
-        if (!allATGC(k)) continue; // we can't handle Ns in this scheme
-        //if (debug) cerr << "kmer " << k << " entropy = " << entropy(k) << endl;
-        if (min_kmer_entropy > 0 && entropy(k) < min_kmer_entropy) continue;
-        uint64_t approx_matches = index->approx_size_of_kmer_matches(k);
-        // Report the approximate match count
-        if (debug) cerr << k << "\t~" << approx_matches << endl;
-        // if we have more than one block worth of kmers on disk, consider this kmer non-informative
-        // we can do multiple mapping by relaxing this
-        if (approx_matches > hit_size_threshold) {
+        kmer_offset += kmer_step;
+        ++seeds.kmers;
+        if (!allATGC(k) // we can't handle Ns in this scheme
+            || low_complexity[kmer_offset]) {
+            ++seeds.low_complexity;
             continue;
         }
+        //if (debug) cerr << "kmer " << k << " entropy = " << entropy(k) << endl;
         
         // Grab the map from node ID to kmer start positions for this particular kmer.
         auto& kmer_positions = positions.at(i);
-        // Fill it in, since we know there won't be too many to work with.
-        index->get_kmer_positions(k, kmer_positions);
+        // Fill it in, if there won't be too many to work with.
+        if (!get_kmer_positions(k, kmer_positions)) {
+            ++seeds.repetitive;
+            continue;
+        }
+        kmer_offsets.at(i) = kmer_offset;
         // ignore this kmer if it has too many hits
         // typically this will be filtered out by the approximate matches filter
-        if (kmer_positions.size() > hit_max) kmer_positions.clear();
+        if (kmer_positions.size() > hit_max) {
+            kmer_positions.clear();
+            ++seeds.repetitive;
+        } else if (kmer_positions.empty()) {
+            ++seeds.missing;
+        } else {
+            ++seeds.found;
+        }
         // Report the actual match count for the kmer
         if (debug) cerr << "\t=" << kmer_positions.size() << endl;
         kmer_count += kmer_positions.size();
@@ -296,6 +614,16 @@ Alignment& Mapper::align_threaded(Alignment& alignment, int& kmer_count, int kme
 
     if (debug) cerr << "kept kmer hits " << kmer_count << endl;
 
+    // if the read matches the graph exactly where the kmers say, we're done,
+    // unless we dropped kmers that could have put it somewhere else too
+    if (try_exact_match && seeds.repetitive == repetitive
+        && align_exact(alignment, positions, kmer_offsets)) {
+        if (debug) cerr << "exact match" << endl;
+        second_best = 0;
+        alignment.set_mapping_quality(compute_mapping_quality(alignment.score(), second_best));
+        return alignment;
+    }
+
     // make threads
     // these start whenever we have a kmer match which is outside of
     // one of the last positions (for the previous kmer) + the kmer stride % wobble (hmm)
@@ -521,10 +849,86 @@ Alignment& Mapper::align_threaded(Alignment& alignment, int& kmer_count, int kme
     }
 
     int thread_ex = thread_extension;
-    map<vector<int64_t>*, Alignment> alignments;
+
+    // The candidate alignments come from a pool kept on the mapper between
+    // reads, so their strings and repeated fields are reused rather than
+    // reallocated. They only carry the sequence; the winner's path and score
+    // are moved into the alignment at the end.
+    size_t candidate_count = 0;
+    auto next_candidate = [this, &candidate_count, &alignment](void) -> Alignment& {
+        if (candidate_count == candidate_pool.size()) {
+            candidate_pool.emplace_back();
+        }
+        Alignment& candidate = candidate_pool[candidate_count++];
+        candidate.Clear();
+        candidate.set_sequence(alignment.sequence());
+        return candidate;
+    };
+
+    // The best and second best candidates so far, where the second best has
+    // to be somewhere else in the graph, sharing no nodes with the best.
+    Alignment* best = nullptr;
+    int second_best_score = 0;
+    auto find_top_two = [this, &candidate_count, &best, &second_best_score](void) {
+        best = nullptr;
+        for (size_t j = 0; j < candidate_count; ++j) {
+            // ties go to the earliest candidate
+            if (best == nullptr || candidate_pool[j].score() > best->score()) {
+                best = &candidate_pool[j];
+            }
+        }
+        second_best_score = 0;
+        if (best == nullptr) return;
+        set<int64_t> best_nodes;
+        for (auto& mapping : best->path().mapping()) {
+            best_nodes.insert(mapping.position().node_id());
+        }
+        for (size_t j = 0; j < candidate_count; ++j) {
+            Alignment& aln = candidate_pool[j];
+            if (&aln == best || aln.score() <= second_best_score) continue;
+            bool elsewhere = true;
+            for (auto& mapping : aln.path().mapping()) {
+                if (best_nodes.count(mapping.position().node_id())) {
+                    elsewhere = false;
+                    break;
+                }
+            }
+            if (elsewhere) second_best_score = aln.score();
+        }
+    };
+
+    // How many of the kmers we looked up we actually found
+    int kmers_with_hits = 0;
+    for (auto& p : positions) {
+        if (!p.empty()) ++kmers_with_hits;
+    }
+    // The best score we could get from aligning to the graph around a thread.
+    // Each kmer we found, but not anywhere in the nodes the thread's graph
+    // could grow to, has to overlap some difference between the read and the
+    // graph there, and a single difference can only break
+    // ceil(kmer_size / stride) kmers. Each one costs at least the match score
+    // of the base it's on. We count the distinct kmers of the read found on
+    // those nodes, not kmer instances, which repeats would inflate.
+    int match_score = 2; // the aligner's default
+    auto score_bound = [&](const vector<int64_t>& thread) {
+        // as far as the soft clip handling below can take it
+        int64_t reach = thread_ex + (int64_t) max(thread_ex, 1) * 10;
+        auto n = node_kmer_order.lower_bound(*thread.begin() - reach);
+        auto end = node_kmer_order.upper_bound(*thread.rbegin() + reach);
+        set<int> covered;
+        for ( ; n != end; ++n) {
+            covered.insert(n->second.begin(), n->second.end());
+        }
+        int missed = max(0, kmers_with_hits - (int) covered.size());
+        int per_difference = (kmer_size + stride - 1) / stride;
+        int differences = (missed + per_difference - 1) / per_difference;
+        return match_score * max(0, (int) sequence.size() - differences);
+    };
 
     // collect the nodes from the best N threads by length
     // and expand subgraphs as before
+    // Threads whose bound can't beat the second best candidate can't change
+    // the top two, so we don't align them.
     //cerr << "extending by " << thread_ex << endl;
     tl = threads_by_length.rbegin();
     bool accepted = false;
@@ -536,6 +940,11 @@ Alignment& Mapper::align_threaded(Alignment& alignment, int& kmer_count, int kme
         auto& threads = tl->second;
         // by definition, our thread should construct a contiguous graph
         for (auto& thread : threads) {
+            if (best != nullptr && score_bound(thread) <= second_best_score) {
+                if (debug) cerr << "skipping cluster " << *thread.begin() << "-" << *thread.rbegin()
+                                << ", it can't beat " << second_best_score << endl;
+                continue;
+            }
             // thread extension should be determined during iteration
             // note that there is a problem and hits tend to be imbalanced
             int64_t first = max((int64_t)0, *thread.begin() - thread_ex);
@@ -546,8 +955,7 @@ Alignment& Mapper::align_threaded(Alignment& alignment, int& kmer_count, int kme
             if (debug) cerr << "getting node range " << first << "-" << last << endl;
             VG* graph = new VG;
             index->get_range(first, last, *graph);
-            Alignment& ta = alignments[&thread];
-            ta = alignment;
+            Alignment& ta = next_candidate();
             // by default, expand the graph a bit so we are likely to map
             //index->get_connected_nodes(*graph);
             graph->remove_orphan_edges();
@@ -555,12 +963,8 @@ Alignment& Mapper::align_threaded(Alignment& alignment, int& kmer_count, int kme
             if (debug) cerr << "got subgraph with " << graph->node_count() << " nodes, " 
                             << graph->edge_count() << " edges" << endl;
                             
-            // Topologically sort the graph, breaking cycles and orienting all edges end to start.
-            // This flips some nodes around, so we need to translate alignments back.
-            set<int64_t> flipped_nodes;
-            graph->orient_nodes_forward(flipped_nodes);
-                            
-            // align
+            // align, which orients the nodes on the side and translates the
+            // alignment back onto the graph as it is
             ta.clear_path();
             ta.set_score(0);
             graph->align(ta);
@@ -602,6 +1006,7 @@ Alignment& Mapper::align_threaded(Alignment& alignment, int& kmer_count, int kme
             }
 
             delete graph;
+            find_top_two();
             
             if (debug) cerr << "score per bp is " << (float)ta.score() / (float)ta.sequence().size() << endl;
             if (greedy_accept && (float)ta.score() / (float)ta.sequence().size() >= target_score_per_bp) {
@@ -612,27 +1017,22 @@ Alignment& Mapper::align_threaded(Alignment& alignment, int& kmer_count, int kme
         }
     }
 
-    // now find the best alignment
-    int sum_score = 0;
-    double mean_score = 0;
-    map<int, set<Alignment*> > alignment_by_score;
-    for (auto& ta : alignments) {
-        Alignment* aln = &ta.second;
-        alignment_by_score[aln->score()].insert(aln);
-    }
-
     // get the best alignment
-    set<Alignment*>& best = alignment_by_score.rbegin()->second;
-    //cerr << alignment_by_score.size() << endl;
-    if (!alignment_by_score.empty()) {
-        alignment = **best.begin();
+    find_top_two();
+    second_best = second_best_score;
+    if (best != nullptr) {
+        alignment.mutable_path()->Swap(best->mutable_path());
+        alignment.set_score(best->score());
+        alignment.set_query_position(best->query_position());
         if (debug) {
-            cerr << "best alignment score " << alignment.score() << endl;
+            cerr << "best alignment score " << alignment.score()
+                 << ", second best " << second_best_score << endl;
         }
     } else {
         alignment.clear_path();
         alignment.set_score(0);
     }
+    alignment.set_mapping_quality(compute_mapping_quality(alignment.score(), second_best_score));
 
     if (debug && alignment.score() == 0) cerr << "failed alignment" << endl;
 
@@ -640,6 +1040,242 @@ Alignment& Mapper::align_threaded(Alignment& alignment, int& kmer_count, int kme
 
 }
 
+void Mapper::find_low_complexity(const string& sequence, int kmer_size, vector<bool>& low_complexity) {
+    low_complexity.assign(sequence.size(), false);
+    if (min_kmer_entropy > 0) {
+        vector<double> entropies;
+        window_entropies(sequence, kmer_size, entropies);
+        for (int i = 0; i < entropies.size(); ++i) {
+            if (entropies[i] < min_kmer_entropy) low_complexity[i] = true;
+        }
+    }
+    if (max_dust_score > 0) {
+        vector<bool> masked;
+        dust_mask(sequence, dust_window, max_dust_score, masked);
+        // kmers with any masked base in them are out, so slide a count of
+        // the masked bases in the kmer along the read
+        int in_kmer = 0;
+        for (int i = 0; i < sequence.size(); ++i) {
+            in_kmer += masked[i];
+            if (i >= kmer_size) in_kmer -= masked[i - kmer_size];
+            if (i >= kmer_size - 1 && in_kmer > 0) low_complexity[i - kmer_size + 1] = true;
+        }
+    }
+}
+
+bool Mapper::get_kmer_positions(const string& kmer, map<int64_t, vector<int32_t> >& positions) {
+    if (oversized_kmers.count(kmer)) return false;
+    auto cached = kmer_hit_cache.find(kmer);
+    if (cached != kmer_hit_cache.end()) {
+        positions = cached->second;
+        return true;
+    }
+    uint64_t approx_matches = index->approx_size_of_kmer_matches(kmer);
+    // Report the approximate match count
+    if (debug) cerr << kmer << "\t~" << approx_matches << endl;
+    // if we have more than one block worth of kmers on disk, consider this kmer non-informative
+    // we can do multiple mapping by relaxing this
+    if (approx_matches > hit_size_threshold) {
+        oversized_kmers.insert(kmer);
+        return false;
+    }
+    index->get_kmer_positions(kmer, positions);
+    kmer_hit_cache[kmer] = positions;
+    return true;
+}
+
+bool Mapper::plan_seeds(const SeedStats& seeds, int read_length, int& kmer_size, int& stride) {
+    // kmers that only cover the read if they're this far apart
+    auto barely_cover = [read_length](int k) {
+        return (int) (read_length / ceil((double) read_length / k));
+    };
+    // Shorter kmers are no less repetitive and no more complex, so if
+    // nothing was usable there's nothing to gain from another attempt.
+    if (seeds.low_complexity == seeds.kmers) return false;
+    if (seeds.found > 0 || seeds.repetitive > seeds.missing) {
+        // Either there were hits that didn't add up to an alignment, or most
+        // kmers were too common to use; in both cases, the same kmers taken
+        // more densely give us more hits to work with.
+        if (stride > 1) {
+            stride = max(1, stride / 2);
+            return true;
+        }
+        if (seeds.found == 0) return false;
+    }
+    // Otherwise, the read differs from the graph too often for kmers this
+    // long to fit between the differences, so try the next size down that's
+    // in the index, or a shorter prefix of the one we have.
+    auto next = kmer_sizes.lower_bound(kmer_size);
+    int smaller = next != kmer_sizes.begin() ? *--next : kmer_size - kmer_sensitivity_step;
+    if (smaller < kmer_min || smaller <= 0) {
+        if (stride > 1) {
+            stride = max(1, stride / 2);
+            return true;
+        }
+        return false;
+    }
+    kmer_size = smaller;
+    stride = barely_cover(kmer_size);
+    return true;
+}
+
+int Mapper::exact_match_score(const string& sequence) {
+    return 2 * sequence.size(); // the aligner's default match score
+}
+
+bool Mapper::align_exact(Alignment& alignment,
+                         const vector<map<int64_t, vector<int32_t> > >& positions,
+                         const vector<int>& kmer_offsets) {
+
+    string& sequence = *alignment.mutable_sequence();
+    if (!allATGC(sequence)) return false;
+
+    // The kmers found have to each be in one place only, and all in the same
+    // walk, so there's nowhere else the read could go. Anchor on the first.
+    int anchor = -1;
+    for (int j = 0; j < positions.size(); ++j) {
+        if (positions[j].empty()) continue;
+        if (positions[j].size() > 1 || positions[j].begin()->second.size() > 1) return false;
+        if (anchor == -1) anchor = j;
+    }
+    if (anchor == -1) return false;
+
+    // sequences of the nodes we look at, in their forward orientation
+    map<int64_t, string> node_sequences;
+    auto oriented_sequence = [this, &node_sequences](int64_t id, bool backward) -> string {
+        auto found = node_sequences.find(id);
+        if (found == node_sequences.end()) {
+            Node node;
+            index->get_node(id, node);
+            found = node_sequences.insert(make_pair(id, node.sequence())).first;
+        }
+        return backward ? reverse_complement(found->second) : found->second;
+    };
+
+    // A piece of the walk: length bases from node_offset along the oriented
+    // node, spelling the read from read_offset.
+    struct Piece {
+        int64_t id;
+        bool backward;
+        int node_offset;
+        int read_offset;
+        int length;
+    };
+
+    // Spell the read from read_offset onwards, from node_offset along the
+    // oriented node, taking the first next node that works at each branch.
+    vector<Piece> right;
+    function<bool(int64_t, bool, int, int)> extend_right
+        = [&](int64_t id, bool backward, int node_offset, int read_offset) {
+        string seq = oriented_sequence(id, backward);
+        int length = min((int) seq.size() - node_offset, (int) sequence.size() - read_offset);
+        if (length < 0 || seq.compare(node_offset, length, sequence, read_offset, length) != 0) {
+            return false;
+        }
+        right.push_back(Piece{id, backward, node_offset, read_offset, length});
+        if (read_offset + length == sequence.size()) return true;
+        vector<pair<int64_t, bool> > next;
+        index->get_nodes_next(id, backward, next);
+        for (auto& n : next) {
+            if (extend_right(n.first, n.second, 0, read_offset + length)) return true;
+        }
+        right.pop_back();
+        return false;
+    };
+
+    // Spell the read before read_end backwards, from before node_end along
+    // the oriented node.
+    vector<Piece> left;
+    function<bool(int64_t, bool, int, int)> extend_left
+        = [&](int64_t id, bool backward, int node_end, int read_end) {
+        string seq = oriented_sequence(id, backward);
+        if (node_end < 0) node_end = seq.size();
+        int length = min(node_end, read_end);
+        if (seq.compare(node_end - length, length, sequence, read_end - length, length) != 0) {
+            return false;
+        }
+        left.push_back(Piece{id, backward, node_end - length, read_end - length, length});
+        if (read_end - length == 0) return true;
+        vector<pair<int64_t, bool> > prev;
+        index->get_nodes_prev(id, backward, prev);
+        for (auto& p : prev) {
+            if (extend_left(p.first, p.second, -1, read_end - length)) return true;
+        }
+        left.pop_back();
+        return false;
+    };
+
+    int64_t anchor_id = positions[anchor].begin()->first;
+    int anchor_offset = positions[anchor].begin()->second.front();
+    int read_offset = kmer_offsets[anchor];
+    if (anchor_offset < 0
+        || !extend_right(anchor_id, false, anchor_offset, read_offset)
+        || (read_offset > 0 && !extend_left(anchor_id, false, anchor_offset, read_offset))) {
+        return false;
+    }
+
+    // put the walk together, joining the two pieces on the anchor node
+    vector<Piece> walk(left.rbegin(), left.rend());
+    if (!walk.empty()) {
+        walk.back().length += right.front().length;
+        walk.insert(walk.end(), right.begin() + 1, right.end());
+    } else {
+        walk = right;
+    }
+
+    // check that every kmer is where the walk puts it
+    for (int j = 0; j < positions.size(); ++j) {
+        if (positions[j].empty()) continue;
+        int64_t id = positions[j].begin()->first;
+        int offset = positions[j].begin()->second.front();
+        bool found = false;
+        for (auto& piece : walk) {
+            if (piece.id == id && !piece.backward
+                && kmer_offsets[j] - piece.read_offset == offset - piece.node_offset
+                && kmer_offsets[j] >= piece.read_offset
+                && kmer_offsets[j] < piece.read_offset + piece.length) {
+                found = true;
+                break;
+            }
+        }
+        if (!found) return false;
+    }
+
+    // and write it out as gssw would have
+    alignment.clear_path();
+    Path* path = alignment.mutable_path();
+    for (auto& piece : walk) {
+        Mapping* mapping = path->add_mapping();
+        mapping->mutable_position()->set_node_id(piece.id);
+        if (piece.backward) {
+            // offsets on reverse mappings count from the other end of the node
+            mapping->set_is_reverse(true);
+            int node_length = node_sequences[piece.id].size();
+            mapping->mutable_position()->set_offset(node_length - piece.node_offset - 1);
+        } else {
+            mapping->mutable_position()->set_offset(piece.node_offset);
+        }
+        Edit* edit = mapping->add_edit();
+        edit->set_from_length(piece.length);
+        edit->set_to_length(piece.length);
+    }
+    alignment.set_score(exact_match_score(sequence));
+    alignment.set_query_position(0);
+    return true;
+}
+
+int Mapper::compute_mapping_quality(int best_score, int second_best_score) {
+    // as BWA does, a tie leaves us no idea which is right
+    if (best_score == 0 || best_score <= second_best_score) return 0;
+    // Treat the scores as log odds in units of 1/lambda, where lambda solves
+    // 1/4 e^(2 lambda) + 3/4 e^(-2 lambda) = 1 for the aligner's default +2/-2
+    // scoring. The chance the best is wrong is then 1 / (1 + e^(lambda diff)).
+    double lambda = log(3.0) / 2.0;
+    double diff = lambda * (best_score - second_best_score);
+    double quality = 10.0 / log(10.0) * (diff + log1p(exp(-diff)));
+    return min(max_mapping_quality, (int) round(quality));
+}
+
 int softclip_start(Alignment& alignment) {
     if (alignment.mutable_path()->mapping_size() > 0) {
         Path* path = alignment.mutable_path();
@@ -17,12 +17,42 @@ namespace vg {
 
 using namespace std;
 
+// what seeding a read with one kmer size and stride came to
+struct SeedStats {
+    int kmers = 0;          // taken from the read
+    int low_complexity = 0; // skipped for Ns or low entropy
+    int repetitive = 0;     // skipped for having too many hits
+    int missing = 0;        // not in the index
+    int found = 0;          // found, and used
+};
+
+// a kmer from a read and a place in the graph it was found
+struct KmerAnchor {
+    int read_offset;
+    int64_t node_id;
+    int32_t node_offset;
+};
+
 class Mapper {
 
 public:
 
     Mapper(Index* idex, gcsa::GCSA* g = NULL);
-    Mapper(void) : index(NULL), best_clusters(0) { }
+    Mapper(void)
+        : index(NULL)
+        , best_clusters(0)
+        , try_exact_match(true)
+        , target_score_per_bp(1.5)
+        , min_kmer_entropy(0)
+        , max_dust_score(0)
+        , dust_window(64)
+        , fragment_model_size(100)
+        , fragment_sigma(4)
+        , discordant_pair_penalty(20)
+        , fragment_same_strand(0)
+        , fragment_length_mean(0)
+        , fragment_length_stdev(0)
+        , max_mapping_quality(60) { }
     ~Mapper(void);
     Index* index;
     gcsa::GCSA* gcsa;
@@ -30,25 +60,110 @@ public:
     Alignment align(string& seq, int kmer_size = 0, int stride = 0, int band_width = 1000);
     Alignment align(Alignment& read, int kmer_size = 0, int stride = 0, int band_width = 1000);
 
+    // align read2 to the graph within pair_window bases of read1's mapping
     void align_mate_in_window(Alignment& read1, Alignment& read2, int pair_window);
 
+    // long reads
+    // The read is seeded once on each strand, with kmers that don't overlap,
+    // and the hits are chained into the longest run that goes through the
+    // graph colinearly with the read. The read is then cut at anchors in the
+    // chain into pieces of at most band_width bases. Each is aligned, with
+    // full dynamic programming, to the graph within reach of the anchors on
+    // either side of it, and the pieces are joined into one alignment.
     Alignment align_banded(Alignment& read, int kmer_size = 0, int stride = 0, int band_width = 1000);
+    // hits for kmers taken every stride bases along the sequence
+    void find_anchors(const string& sequence, int kmer_size, int stride, vector<KmerAnchor>& anchors);
+    // replace the anchors with their longest chain, in read order, where
+    // consecutive anchors are no farther apart in the graph (in bases, by
+    // Index::for_each_node_within) than in the read, give or take
+    // max_thread_gap; the graph distance has no direction, so the chain is
+    // colinear in the read but isn't checked to go forward in the graph
+    void chain_anchors(vector<KmerAnchor>& anchors);
 
     // paired-end based
+    // Once the fragment model is ready, the second mate is first looked for
+    // near the first, where the model says it should be, and only seeded on
+    // its own if it isn't found there. Candidate pairs are scored jointly, and
+    // pairs that don't fit the model are marked as discordant.
     pair<Alignment, Alignment> align_paired(Alignment& read1,
                                             Alignment& read2,
                                             int kmer_size = 0,
                                             int stride = 0,
                                             int band_width = 1000,
-                                            int pair_window = 64);
+                                            int pair_window = 700);
+
+    // fragment length and orientation model for paired reads
+    // Lengths are measured in bases, as the graph distance between the nodes
+    // of the two mates (see Index::get_distance_within), so they don't depend
+    // on how the nodes are numbered. The model is learned online from the
+    // first fragment_model_size pairs where both mates align confidently
+    // within pair_window bases of each other.
+    // Each mapper learns its own, so each thread does too.
+    bool fragment_model_ready(void);
+    // record the pair in the model, if we're still learning and it's confident
+    void record_fragment(const Alignment& aln1, const Alignment& aln2, int pair_window);
+    // the length, or -1 if the mates are more than max_length bases apart
+    int64_t fragment_length(const Alignment& aln1, const Alignment& aln2, int64_t max_length);
+    // how far from the mean length the model allows a pair to be
+    double fragment_length_slack(void);
+    // true if both mates are aligned with the orientation and within the
+    // length the model expects
+    bool pair_consistent(const Alignment& aln1, const Alignment& aln2);
+    // the alignment score of the pair, less a penalty if it's discordant
+    int pair_score(const Alignment& aln1, const Alignment& aln2);
+    // how far from the first mate, in bases, the model says to look for a
+    // second of the given length
+    int fragment_window(int mate_length);
+    // set up the second mate to be aligned in the orientation the model
+    // expects relative to the first; the model must be ready
+    void orient_mate(const Alignment& aln1, Alignment& read2);
+    // align the second mate within pair_window bases of the first, oriented
+    // by the model, or on whichever strand aligns better if it isn't ready
+    void rescue_mate(Alignment& aln1, Alignment& read2, int pair_window);
 
     // base algorithm for above
+    // Sets the mapping quality from the best and second best candidates, and
+    // skips clusters that couldn't beat the second best.
+    // second_best gets the second best score, from somewhere else in the graph.
+    // seeds gets what happened to the kmers taken from the read.
     Alignment& align_threaded(Alignment& read,
                               int& hit_count,
+                              int& second_best,
+                              SeedStats& seeds,
                               int kmer_size = 0,
                               int stride = 0,
                               int attempt = 0);
 
+    // Mark the offsets in the sequence where kmers start that are too low in
+    // complexity to seed with, by their entropy or by falling in a region
+    // DUST masks. Both are computed over the whole read in one pass.
+    void find_low_complexity(const string& sequence, int kmer_size, vector<bool>& low_complexity);
+
+    // Where the kmer is in the index, remembered for the rest of the read.
+    // Returns false without looking if it has too many matches to be useful.
+    bool get_kmer_positions(const string& kmer, map<int64_t, vector<int32_t> >& positions);
+    // After an attempt that didn't align, choose the kmer size and stride to
+    // try next from what its seeds came to, or return false if no other
+    // choice looks any more likely to work. Shorter kmers come from the sizes
+    // in the index first.
+    bool plan_seeds(const SeedStats& seeds, int read_length, int& kmer_size, int& stride);
+
+    // If every kmer found in the read was found in one place only, and the
+    // read spells out a walk through the graph exactly through all of them,
+    // write that walk into the alignment and return true, so no dynamic
+    // programming is needed. The walk is found by comparing the read to the
+    // node sequences directly, out from the first kmer. It isn't tried if any
+    // kmer was dropped for having too many hits.
+    bool align_exact(Alignment& alignment,
+                     const vector<map<int64_t, vector<int32_t> > >& positions,
+                     const vector<int>& kmer_offsets);
+    // the score of a read that matches the graph exactly
+    int exact_match_score(const string& sequence);
+
+    // phred-scaled chance that the best alignment is the wrong one, given
+    // the score of the best and of the next best elsewhere
+    int compute_mapping_quality(int best_score, int second_best_score);
+
     // not used
     Alignment& align_simple(Alignment& alignment, int kmer_size = 0, int stride = 0);
 
@@ -69,13 +184,33 @@ public:
     float target_score_per_bp;
     bool prefer_forward;
     bool greedy_accept;
+    bool try_exact_match; // take align_exact's walk when it finds one
     float min_kmer_entropy;
+    float max_dust_score;
+    int dust_window;
+    int fragment_model_size;
+    float fragment_sigma;
+    int discordant_pair_penalty;
+    int max_mapping_quality;
+
+    // what we've learned about fragments so far
+    vector<int64_t> fragment_lengths;
+    int fragment_same_strand;
+    double fragment_length_mean;
+    double fragment_length_stdev;
+
+    // candidate alignments for align_threaded, reused from read to read
+    vector<Alignment> candidate_pool;
+    // kmers looked up for the current read
+    map<string, map<int64_t, vector<int32_t> > > kmer_hit_cache;
+    set<string> oversized_kmers;
 
 };
 
 // utility
 int softclip_start(Alignment& alignment);
 int softclip_end(Alignment& alignment);
+const int balanced_stride(int read_length, int kmer_size, int stride);
 const vector<string> balanced_kmers(const string& seq, int kmer_size, int stride);
 
 
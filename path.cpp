@@ -83,7 +83,8 @@ void Paths::extend(Path& p) {
     for (int i = 0; i < p.mapping_size(); ++i) {
         const Mapping& m = p.mapping(i);
         path.push_back(m);
-        get_node_mapping(m.position().node_id()).insert(make_pair(p.name(), &path.back()));
+        list<Mapping>::iterator mi = path.end(); --mi;
+        index_mapping(get_path_id(p.name()), mi);
     }
 }
 
@@ -125,10 +126,11 @@ Path& append_path(Path& a, const Path& b) {
 // problem, won't allow us to keep multiple identical mapping to the same node,
 // as will happen with looping paths
 bool Paths::has_mapping(const string& name, const Mapping& m) {
-    auto& node_mapping = get_node_mapping(m.position().node_id());
-    for (auto& p : node_mapping) {
-        const string& path_name = p.first;
-        if (path_name == name) {
+    if (!has_node_mapping(m.position().node_id())) return false;
+    auto n = name_to_id.find(name);
+    if (n == name_to_id.end()) return false;
+    for (auto& p : get_node_mapping(m.position().node_id())) {
+        if (p.first == n->second) {
             return true;
         }
     }
@@ -141,13 +143,9 @@ void Paths::append_mapping(const string& name, const Mapping& m) {
 // TODO check if we have the mapping already ?
     if (!has_mapping(name, m)) {
         pt.push_back(m);
-        Mapping* mp = &pt.back();
         // add it to the node mappings
-        auto& ms = get_node_mapping(m.position().node_id());
-        ms.insert(make_pair(name, mp));
         list<Mapping>::iterator mi = pt.end(); --mi;
-        mapping_itr[mp] = mi;
-        mapping_path[mp] = name;
+        index_mapping(get_path_id(name), mi);
     }
 }
 
@@ -190,28 +188,62 @@ void Paths::swap_node_ids(hash_map<int64_t, int64_t> id_mapping) {
     rebuild_node_mapping();
 }
 
+int64_t Paths::get_path_id(const string& name) {
+    auto n = name_to_id.find(name);
+    if (n != name_to_id.end()) {
+        return n->second;
+    }
+    int64_t id = id_to_name.size();
+    id_to_name.push_back(name);
+    name_to_id[name] = id;
+    return id;
+}
+
+const string& Paths::get_path_name(int64_t id) {
+    return id_to_name.at(id);
+}
+
+// order a node's mappings by path name, then by Mapping*, as the set we used
+// to keep them in did; the index itself is unordered, so output walking a
+// node's mappings (e.g. to_gfa) sorts them with this
+bool Paths::node_mapping_before(const pair<int64_t, Mapping*>& a, const pair<int64_t, Mapping*>& b) {
+    if (a.first != b.first) {
+        return get_path_name(a.first) < get_path_name(b.first);
+    }
+    return a.second < b.second;
+}
+
+void Paths::index_mapping(int64_t path_id, list<Mapping>::iterator m) {
+    Mapping* mp = &*m;
+    node_mapping[mp->position().node_id()].push_back(make_pair(path_id, mp));
+    mapping_place[mp] = make_pair(path_id, m);
+}
+
+void Paths::unindex_mapping(Mapping* m) {
+    int64_t id = m->position().node_id();
+    auto n = node_mapping.find(id);
+    if (n != node_mapping.end()) {
+        auto& node_path_mapping = n->second;
+        swap_remove(node_path_mapping, make_pair(mapping_place[m].first, m));
+        if (node_path_mapping.empty()) node_mapping.erase(n);
+    }
+    mapping_place.erase(m);
+}
+
 void Paths::rebuild_node_mapping(void) {
     // starts with paths and rebuilds the index
-    node_mapping.clear();
-    for (auto& p : _paths) {
-        const string& path_name = p.first;
-        list<Mapping>& path = p.second;
-        for (auto& m : path) {
-            get_node_mapping(m.position().node_id()).insert(make_pair(path_name, &m));
-        }
-    }
+    // the node and mapping indexes are kept together, so rebuild both
+    rebuild_mapping_aux();
 }
 
 void Paths::rebuild_mapping_aux(void) {
-//    map<Mapping*, list<Mapping>::iterator> mapping_itr
-    mapping_itr.clear();
-    mapping_path.clear();
+    node_mapping.clear();
+    mapping_place.clear();
     for (auto& p : _paths) {
-        const string& path_name = p.first;
+        int64_t path_id = get_path_id(p.first);
         list<Mapping>& path = p.second;
         for (list<Mapping>::iterator i = path.begin(); i != path.end(); ++i) {
-            mapping_itr[&*i] = i;
-            mapping_path[&*i] = path_name;
+            index_mapping(path_id, i);
         }
     }
 }
@@ -221,19 +253,16 @@ void Paths::remove_node(int64_t id) {
 }
 
 list<Mapping>::iterator Paths::remove_mapping(Mapping* m) {
-    if (mapping_path.find(m) == mapping_path.end()) cerr << "no mapping" << endl;
-    const string& path_name = mapping_path[m];
-    int64_t id = m->position().node_id();
-    auto& x = _paths[path_name];
-    list<Mapping>::iterator p = _paths[path_name].erase(mapping_itr[m]);
-    if (has_node_mapping(id)) {
-        auto& node_path_mapping = get_node_mapping(id);
-        node_path_mapping.erase(make_pair(path_name, m));
-        if (node_path_mapping.empty()) node_mapping.erase(id);
-    }
-    mapping_path.erase(m);
-    mapping_itr.erase(m);
-    return p;
+    auto place = mapping_place.find(m);
+    if (place == mapping_place.end()) {
+        cerr << "[vg::Paths] error: cannot remove mapping, it is not in any path" << endl;
+        exit(1);
+    }
+    list<Mapping>& path = _paths[get_path_name(place->second.first)];
+    list<Mapping>::iterator w = place->second.second;
+    // drop it from the indexes before the list frees the Mapping
+    unindex_mapping(m);
+    return path.erase(w);
 }
 
 list<Mapping>::iterator Paths::insert_mapping(list<Mapping>::iterator w, const string& path_name, const Mapping& m) {
@@ -246,9 +275,7 @@ list<Mapping>::iterator Paths::insert_mapping(list<Mapping>::iterator w, const s
     } else {
         p = path.insert(w, m);
     }
-    get_node_mapping(m.position().node_id()).insert(make_pair(path_name, &*p));
-    mapping_path[&*p] = path_name;
-    mapping_itr[&*p] = p;
+    index_mapping(get_path_id(path_name), p);
     return p;
 }
 
@@ -270,6 +297,9 @@ bool Paths::empty(void) const {
 void Paths::clear(void) {
     _paths.clear();
     node_mapping.clear();
+    mapping_place.clear();
+    name_to_id.clear();
+    id_to_name.clear();
 }
 
 list<Mapping>& Paths::get_path(const string& name) {
@@ -281,7 +311,6 @@ void Paths::remove_paths(const set<string>& names) {
         _paths.erase(name);
     }
     rebuild_node_mapping();
-    rebuild_mapping_aux();
 }
 
 void Paths::keep_paths(const set<string>& names) {
@@ -314,23 +343,21 @@ bool Paths::has_node_mapping(Node* n) {
     return node_mapping.find(n->id()) != node_mapping.end();
 }
 
-set<pair<string, Mapping*> >& Paths::get_node_mapping(int64_t id) {
+vector<pair<int64_t, Mapping*> >& Paths::get_node_mapping(int64_t id) {
     return node_mapping[id];
 }
 
-set<pair<string, Mapping*> >& Paths::get_node_mapping(Node* n) {
+vector<pair<int64_t, Mapping*> >& Paths::get_node_mapping(Node* n) {
     return node_mapping[n->id()];
 }
 
 Mapping* Paths::traverse_left(Mapping* mapping) {
-    // Get the iterator for this Mapping*
-    list<Mapping>::iterator place = mapping_itr.at(mapping);
-    
-    // Get the path name for this Mapping*
-    string path_name = mapping_path_name(mapping);
+    // Get the path id and iterator for this Mapping*
+    auto& where = mapping_place.at(mapping);
+    list<Mapping>::iterator place = where.second;
     
     // Get the list that the iterator is in
-    list<Mapping>& path_list = _paths.at(path_name);
+    list<Mapping>& path_list = _paths.at(get_path_name(where.first));
     
     // If we're already the beginning, return null.
     if(place == path_list.begin()) {
@@ -344,14 +371,12 @@ Mapping* Paths::traverse_left(Mapping* mapping) {
 }
 
 Mapping* Paths::traverse_right(Mapping* mapping) {
-    // Get the iterator for this Mapping*
-    list<Mapping>::iterator place = mapping_itr.at(mapping);
-    
-    // Get the path name for this Mapping*
-    string path_name = mapping_path_name(mapping);
+    // Get the path id and iterator for this Mapping*
+    auto& where = mapping_place.at(mapping);
+    list<Mapping>::iterator place = where.second;
     
     // Get the list that the iterator is in
-    list<Mapping>& path_list = _paths.at(path_name);
+    list<Mapping>& path_list = _paths.at(get_path_name(where.first));
     
     // Advance the iterator right.
     place++;
@@ -366,39 +391,37 @@ Mapping* Paths::traverse_right(Mapping* mapping) {
 }
 
 string Paths::mapping_path_name(Mapping* m) {
-    auto n = mapping_path.find(m);
-    if (n == mapping_path.end()) {
+    auto n = mapping_place.find(m);
+    if (n == mapping_place.end()) {
         return "";
     } else {
-        return n->second;
+        return get_path_name(n->second.first);
     }
 }
 
 set<string> Paths::of_node(int64_t id) {
     set<string> path_names;
-    auto& node_mapping = get_node_mapping(id);
-    for (auto& p : node_mapping) {
-        path_names.insert(p.first);
+    if (!has_node_mapping(id)) return path_names;
+    for (auto& p : get_node_mapping(id)) {
+        path_names.insert(get_path_name(p.first));
     }
     return path_names;
 }
 
 bool Paths::are_consecutive_nodes_in_path(int64_t id1, int64_t id2, const string& path_name) {
-    if (of_node(id1).count(path_name) && of_node(id2).count(path_name)) {
-        auto& p1 = get_node_mapping(id1);
-        auto& p2 = get_node_mapping(id2);
-        // is p1 directly before p2?
-        list<Mapping>::iterator i1, i2;
-        // note that this will get the first mapping in each path, not an arbitrary one
-        // (we can have looping paths, so there could be several mappings per path)
-        for (auto& nm : p1) {
-            if (nm.first == path_name) i1 = mapping_itr[nm.second];
-        }
-        for (auto& nm : p2) {
-            if (nm.first == path_name) i2 = mapping_itr[nm.second];
-        }
-        ++i1; // increment the first node's mapping iterator
-        if (i1 == i2) return true;
+    auto n = name_to_id.find(path_name);
+    if (n == name_to_id.end() || !has_node_mapping(id1) || !has_node_mapping(id2)) {
+        return false;
+    }
+    int64_t path_id = n->second;
+    // is a mapping of id1 directly before a mapping of id2 in the path?
+    // (we can have looping paths, so there could be several mappings per path)
+    auto& path = _paths[path_name];
+    for (auto& nm : get_node_mapping(id1)) {
+        if (nm.first != path_id) continue;
+        list<Mapping>::iterator next = mapping_place.at(nm.second).second;
+        ++next;
+        if (next != path.end() && next->position().node_id() == id2) return true;
     }
     return false;
 }
@@ -10,6 +10,7 @@
 #include "vg.pb.h"
 #include "edit.hpp"
 #include "hash_map.hpp"
+#include "swap_remove.hpp"
 
 namespace vg {
 
@@ -49,19 +50,28 @@ public:
     }
 
     // This maps from path name to the list of Mappings for that path.
+    // The steps stay in a list rather than packed arrays, because divide_node
+    // and the traversal helpers rely on stable Mapping* and list iterators.
     map<string, list<Mapping> > _paths;
-    // This maps from Mapping* pointer to its iterator in its list of Mappings
-    // for its path. The list in question is stroed above in _paths. Recall that
-    // std::list iterators are bidirectional.
-    map<Mapping*, list<Mapping>::iterator> mapping_itr;
-    // This maps from Mapping* pointer to the name of the path it belongs to
-    // (which can then be used to get the list its iterator belongs to).
-    map<Mapping*, string> mapping_path;
+    // Path names are interned to small integer ids, so the per-mapping
+    // indexes below hold an id rather than a copy of the name.
+    map<string, int64_t> name_to_id;
+    vector<string> id_to_name;
+    // Get the id for the path name, assigning a new one if it has none.
+    int64_t get_path_id(const string& name);
+    const string& get_path_name(int64_t id);
+    // This maps from Mapping* pointer to the id of the path it belongs to and
+    // its iterator in the list of Mappings for that path. The list in question
+    // is stored above in _paths. Recall that std::list iterators are
+    // bidirectional.
+    hash_map<Mapping*, pair<int64_t, list<Mapping>::iterator> > mapping_place;
     void rebuild_mapping_aux(void);
-    // This maps from node ID to a set of path name, mapping instance pairs.
+    // This maps from node ID to the (path id, mapping instance) pairs on it,
+    // in no particular order; sort with node_mapping_before where it matters.
     // Note that we don't have a map for each node, because each node can appear
     // along any given path multiple times, with multiple Mapping* pointers.
-    map<int64_t, set<pair<string, Mapping*> > > node_mapping;
+    hash_map<int64_t, vector<pair<int64_t, Mapping*> > > node_mapping;
+    bool node_mapping_before(const pair<int64_t, Mapping*>& a, const pair<int64_t, Mapping*>& b);
     
     void rebuild_node_mapping(void);
     //void sync_paths_with_mapping_lists(void);
@@ -78,8 +88,9 @@ public:
     bool has_mapping(const string& name, const Mapping& m);
     bool has_node_mapping(int64_t id);
     bool has_node_mapping(Node* n);
-    set<pair<string, Mapping*> >& get_node_mapping(Node* n);
-    set<pair<string, Mapping*> >& get_node_mapping(int64_t id);
+    // The (path id, mapping) pairs on the node. Use get_path_name for the names.
+    vector<pair<int64_t, Mapping*> >& get_node_mapping(Node* n);
+    vector<pair<int64_t, Mapping*> >& get_node_mapping(int64_t id);
     // Go left along the path that this Mapping* belongs to, and return the
     // Mapping* there, or null if this Mapping* is the first in its path.
     Mapping* traverse_left(Mapping* mapping);
@@ -110,6 +121,11 @@ public:
     // This is only efficient to do in a batch.
     void swap_node_ids(hash_map<int64_t, int64_t> id_mapping);
     void for_each_mapping(const function<void(Mapping*)>& lambda);
+
+private:
+    // add and remove a mapping stored in the given path from the indexes
+    void index_mapping(int64_t path_id, list<Mapping>::iterator m);
+    void unindex_mapping(Mapping* m);
 };
 
 Path& increment_node_mapping_ids(Path& p, int64_t inc);
@@ -9,6 +9,9 @@
 #include <functional>
 #include <vector>
 #include <list>
+#include <map>
+#include <string>
+#include <omp.h>
 #include "google/protobuf/stubs/common.h"
 #include "google/protobuf/io/zero_copy_stream.h"
 #include "google/protobuf/io/zero_copy_stream_impl.h"
@@ -52,18 +55,171 @@ bool write(std::ostream& out, uint64_t count, std::function<T(uint64_t)>& lambda
     return !count || written == count;
 }
 
+// serialize a group of objects into a self-contained chunk in memory
+// the chunk holds the count and the size-prefixed objects in a single gzip member,
+// so chunks can be built in parallel and concatenated onto a stream in any order
+// to produce the same format that write() generates
+template <typename T>
+bool write_to_string(std::string& chunk, const std::vector<T>& objects) {
+
+    ::google::protobuf::io::ZeroCopyOutputStream *raw_out =
+          new ::google::protobuf::io::StringOutputStream(&chunk);
+    ::google::protobuf::io::GzipOutputStream *gzip_out =
+          new ::google::protobuf::io::GzipOutputStream(raw_out);
+    ::google::protobuf::io::CodedOutputStream *coded_out =
+          new ::google::protobuf::io::CodedOutputStream(gzip_out);
+
+    if (!objects.empty()) {
+        coded_out->WriteVarint64(objects.size());
+    }
+
+    std::string s;
+    for (auto& object : objects) {
+        object.SerializeToString(&s);
+        coded_out->WriteVarint32(s.size());
+        coded_out->WriteRaw(s.data(), s.size());
+    }
+
+    delete coded_out;
+    delete gzip_out;
+    delete raw_out;
+
+    return !objects.empty();
+}
+
 template <typename T>
 bool write_buffered(std::ostream& out, std::vector<T>& buffer, uint64_t buffer_limit) {
     bool wrote = false;
     if (buffer.size() >= buffer_limit) {
-        std::function<T(uint64_t)> lambda = [&buffer](uint64_t n) { return buffer.at(n); };
+        // serialize and compress in the calling thread
+        // only copying the finished bytes onto the stream is serialized
+        std::string chunk;
+        write_to_string(chunk, buffer);
 #pragma omp critical (stream_out)
-        wrote = write(out, buffer.size(), lambda);
+        {
+            out.write(chunk.data(), chunk.size());
+            wrote = out.good();
+        }
         buffer.clear();
     }
     return wrote;
 }
 
+// Collects compressed chunks of objects from many threads and appends them to
+// a single output stream. Each thread compresses its own chunk without holding
+// any lock. Whichever thread manages to take the writer lock then drains every
+// chunk which is ready, so at any moment there is only one writer, and the
+// others go back to work rather than waiting on it. If ordered is set, chunks
+// are written in the order of the ids they are submitted with, which must run
+// 0, 1, 2, ... without gaps.
+template <typename T>
+class ChunkWriter {
+public:
+
+    ChunkWriter(std::ostream& out, bool ordered = false)
+        : out(out)
+        , ordered(ordered)
+        , next_id(0)
+        , next_to_write(0) {
+        omp_init_lock(&queue_lock);
+        omp_init_lock(&writer_lock);
+    }
+
+    ~ChunkWriter(void) {
+        flush();
+        omp_destroy_lock(&queue_lock);
+        omp_destroy_lock(&writer_lock);
+    }
+
+    // compress the objects in the calling thread and queue them for output
+    // the chunk id is only used when the writer is ordered
+    void write(const std::vector<T>& objects, uint64_t chunk_id = 0) {
+        std::string chunk;
+        write_to_string(chunk, objects);
+        omp_set_lock(&queue_lock);
+        if (!ordered) chunk_id = next_id++;
+        pending[chunk_id].swap(chunk);
+        omp_unset_lock(&queue_lock);
+        drain(false);
+    }
+
+    // like write_buffered, write the buffer out and clear it once it reaches the limit
+    // chunks written this way have no id, so the writer can't be ordered
+    bool write_buffered(std::vector<T>& buffer, uint64_t buffer_limit) {
+        assert(!ordered);
+        if (buffer.size() >= buffer_limit && !buffer.empty()) {
+            write(buffer);
+            buffer.clear();
+            return true;
+        }
+        return false;
+    }
+
+    // write everything that is ready, waiting for any thread that is writing now
+    void flush(void) {
+        drain(true);
+        out.flush();
+    }
+
+private:
+
+    // Write ready chunks until there are none left. If wait is false we return
+    // immediately when another thread is already writing, as it will pick up
+    // our chunk.
+    void drain(bool wait) {
+        if (wait) {
+            omp_set_lock(&writer_lock);
+        } else if (!omp_test_lock(&writer_lock)) {
+            return;
+        }
+        while (true) {
+            write_ready();
+            omp_unset_lock(&writer_lock);
+            // A chunk queued after our last look, but before we let go of the
+            // writer lock, was left for us by a thread that saw us writing.
+            // If there is one, and nobody else has taken over, write it too.
+            if (!chunk_ready() || !omp_test_lock(&writer_lock)) break;
+        }
+    }
+
+    // true if the next chunk to write is queued
+    bool chunk_ready(void) {
+        omp_set_lock(&queue_lock);
+        auto c = pending.begin();
+        bool ready = c != pending.end() && (!ordered || c->first == next_to_write);
+        omp_unset_lock(&queue_lock);
+        return ready;
+    }
+
+    // write chunks until the next one isn't ready; the writer lock must be held
+    void write_ready(void) {
+        std::string chunk;
+        while (true) {
+            bool ready = false;
+            omp_set_lock(&queue_lock);
+            auto c = pending.begin();
+            if (c != pending.end() && (!ordered || c->first == next_to_write)) {
+                chunk.swap(c->second);
+                pending.erase(c);
+                ++next_to_write;
+                ready = true;
+            }
+            omp_unset_lock(&queue_lock);
+            if (!ready) break;
+            out.write(chunk.data(), chunk.size());
+            chunk.clear();
+        }
+    }
+
+    std::ostream& out;
+    bool ordered;
+    uint64_t next_id;
+    uint64_t next_to_write;
+    std::map<uint64_t, std::string> pending;
+    omp_lock_t queue_lock;
+    omp_lock_t writer_lock;
+};
+
 // deserialize the input stream into the objects
 // skips over groups of objects with count 0
 // takes a callback function to be called on the objects, and another to be called per object group.
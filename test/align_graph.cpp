@@ -0,0 +1,39 @@
+#include <iostream>
+#include <fstream>
+#include <omp.h>
+#include "vg.hpp"
+
+using namespace std;
+using namespace vg;
+
+// align the sequence to the graph from several threads at once, then write
+// the graph back out so it can be compared with what was read in; fails if
+// the threads didn't all get the same alignment
+int main(int argc, char *argv[])
+{
+    if (argc != 3) {
+        cerr << "usage: " << argv[0] << " <graph.vg> <sequence>" << endl;
+        return 1;
+    }
+    ifstream in(argv[1]);
+    VG graph(in);
+    string seq = argv[2];
+
+    int threads = 4;
+    vector<string> alignments(threads);
+#pragma omp parallel for num_threads(threads)
+    for (int i = 0; i < threads; ++i) {
+        string s = seq;
+        alignments[i] = graph.align(s).SerializeAsString();
+    }
+    for (auto& a : alignments) {
+        if (a != alignments.front()) {
+            cerr << "alignments from different threads differ" << endl;
+            return 1;
+        }
+    }
+
+    graph.serialize_to_ostream(cout);
+
+    return 0;
+}
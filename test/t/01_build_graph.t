@@ -5,6 +5,10 @@ BASH_TAP_ROOT=../bash-tap
 
 PATH=..:$PATH # for vg
 
-plan tests 1
+plan tests 3
 
 is $(./build_graph | wc -l) 1 "graph building with the API"
+
+seq=$(grep -v '>' small/x.fa | tr -d '\n' | head -c 300)
+is "$(./window_entropy $seq 11)" "290 0" "window entropies match the entropy of each window"
+is "$(./window_entropy AAAAAAAAAAAACACACACACAGGGGGGTACGTACGTTTTTTTTT 8)" "38 0" "window entropies match the entropy of each window in low complexity sequence"
@@ -7,7 +7,7 @@ PATH=..:$PATH # for vg
 
 export LC_ALL="en_US.utf8" # force ekg's favorite sort order 
 
-plan tests 20
+plan tests 25
 
 is $(vg construct -r small/x.fa -v small/x.vcf.gz | vg stats -z - | grep nodes | cut -f 2) 210 "construction produces the right number of nodes"
 
@@ -63,6 +63,23 @@ x3=$(for i in $(seq 100); do
 
 is $x3 1 "the number of threads and regions used in construction has no effect on the graph"
 
+vg construct -r small/x.fa -v small/x.vcf.gz >x.vg
+vg construct -r small/x.fa -v small/x.vcf.gz -S >xs.vg
+vg construct -r small/x.fa -v small/x.vcf.gz -S -z 3 -t 4 >xz.vg
+
+is "$(vg stats -z xs.vg)" "$(vg stats -z x.vg)" "streaming construction makes as many nodes and edges as building the graph in memory"
+is "$(vg stats -z xz.vg)" "$(vg stats -z x.vg)" "streaming construction in many chunks makes as many nodes and edges"
+is "$(vg stats -l xz.vg) $(vg stats -l xs.vg)" "$(vg stats -l x.vg) $(vg stats -l x.vg)" "streamed graphs have the same total sequence length"
+is "$(vg view xz.vg | grep ^P | wc -l) $(vg view xs.vg | grep ^P | wc -l)" "$(vg view x.vg | grep ^P | wc -l) $(vg view x.vg | grep ^P | wc -l)" "streamed graphs have the same path"
+
+rm -f x.vg xs.vg xz.vg
+
+x4=$(for threads in 1 2 4 8 16; do
+    vg construct -r small/x.fa -v small/x.vcf.gz -S -z 5 -t $threads | md5sum;
+    done | sort | uniq | wc -l)
+
+is $x4 1 "streaming construction writes its chunks in order whatever the number of threads"
+
 vg construct -r 1mb1kgp/z.fa -v 1mb1kgp/z.vcf.gz -R z:10-20 >/dev/null
 is $? 0 "construction of a graph with two head nodes succeeds"
 
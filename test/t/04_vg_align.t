@@ -5,7 +5,7 @@ BASH_TAP_ROOT=../bash-tap
 
 PATH=..:$PATH # for vg
 
-plan tests 8
+plan tests 11
 
 is $(vg construct -r small/x.fa -v small/x.vcf.gz | vg align -s CTACTGACAGCAGAAGTTTGCTGTGAAGATTAAATTAGGTGATGCTTG -j - | tr ',' '\n' | grep node_id | grep "72\|74\|75\|77" | wc -l) 4 "alignment traverses the correct path"
 
@@ -27,3 +27,10 @@ rm t.vg
 
 
 is $(vg align -s TATATATATACCCCCCCCC -j cyclic/all.vg | jq ".path.mapping[].position.node_id" | tr '\n' ',' | grep "5,6" | wc -l) 1  "alignment to cyclic graphs works"
+
+is $(vg align -s CAAATAAGTGTAATCA -j reversing/reversing_edge.vg | jq -c '[.path.mapping[] | [.position.node_id, .is_reverse // false]]') "[[1,false],[2,true],[3,false]]" "alignment across reversing edges refers to the nodes as they are in the graph"
+
+./align_graph reversing/reversing_edge.vg CAAATAAGTGTAATCA >aligned.vg
+is $? 0 "threads aligning against the same graph get the same alignment"
+is "$(vg view aligned.vg)" "$(vg view reversing/reversing_edge.vg)" "alignment leaves node sequences and edges of the graph unchanged"
+rm -f aligned.vg
@@ -7,7 +7,7 @@ PATH=..:$PATH # for vg
 
 export LC_ALL="en_US.utf8" # force ekg's favorite sort order 
 
-plan tests 30
+plan tests 32
 
 vg construct -r small/x.fa -v small/x.vcf.gz >x.vg
 is $? 0 "construction"
@@ -78,6 +78,12 @@ vg index -s x.vg
 is $(vg index -D x.vg | grep +g | grep +p | wc -l) $(vg view x.vg | grep ^P | wc -l) "correct number of elements in path index"
 is $(vg index -D x.vg | grep +path_id | wc -l) 1 "path id recorded"
 is $(vg index -D x.vg | grep +path_name | wc -l) 1 "path name recorded"
+nodes=$(vg view x.vg | grep ^S | awk '{ print "-n", $2 }' | head -50 | tr '\n' ' ')
+searched=$(vg find $nodes -P x x.vg | md5sum | awk '{ print $1 }')
+rm -rf x.vg.index
+vg index -s -O x.vg
+is $(vg index -D x.vg | grep +o+ | wc -l) $(comm -23 <(vg view x.vg | grep ^S | cut -f 2 | sort) <(vg view x.vg | grep ^P | cut -f 2 | sort -u) | wc -l | awk '{ print $1 * 2 }') "path anchors stored for both orientations of each node off the path"
+is $(vg find $nodes -P x x.vg | md5sum | awk '{ print $1 }') $searched "stored path anchors give the same path positions as searching"
 rm -rf x.vg.index x.vg
 
 vg construct -r small/x.fa -v small/x.vcf.gz >x.vg
@@ -5,7 +5,7 @@ BASH_TAP_ROOT=../bash-tap
 
 PATH=..:$PATH # for vg
 
-plan tests 15
+plan tests 34
 
 vg construct -r small/x.fa -v small/x.vcf.gz >x.vg
 vg index -s -k 11 x.vg
@@ -21,6 +21,12 @@ is $(vg map -s TCAGATTCTCATCCCTCCTCAAGGGCGTCTAACTACTCCACATCAAAGCTACCCAGGCCATTTTA
 
 is $(vg map -r <(vg sim -s 69 -n 1000 -l 100 x.vg) x.vg | vg view -a - | jq -c '.score == 200 // [.score, .sequence]' | grep -v true | wc -l) 0 "alignment works on a small graph"
 
+vg sim -s 71 -n 200 -l 100 x.vg >sim.txt
+is $(vg map -r sim.txt -t 1 x.vg | vg view -a - | jq -c '[.score, .path.mapping[0].position.offset, [.path.mapping[].position.node_id]]' | md5sum | awk '{ print $1 }') \
+   $(vg map -r sim.txt -t 1 -e x.vg | vg view -a - | jq -c '[.score, .path.mapping[0].position.offset, [.path.mapping[].position.node_id]]' | md5sum | awk '{ print $1 }') \
+   "reads placed exactly by their kmers align as they would with the aligner"
+rm -f sim.txt
+
 seq=TCAGATTCTCATCCCTCCTCAAGGGCTTCTAACTACTCCACATCAAAGCTACCCAGGCCATTTTAAGTTTCCTGTGGACTAAGGACAAAGGTGCGGGGAG
 is $(vg map -s $seq x.vg | vg view -a - | jq -c '[.score, .sequence, .path.node_id]' | md5sum | awk '{print $1}') \
    $(vg map -s $seq -J x.vg | jq -c '[.score, .sequence, .path.node_id]' | md5sum | awk '{print $1}') \
@@ -30,6 +36,108 @@ is $(vg map -b small/x.bam x.vg -J | jq .quality | grep null | wc -l) 0 "alignme
 
 is $(vg map -s $seq -B 30 x.vg | vg surject -d x.vg.index -s - | wc -l) 4 "banded alignment produces a correct alignment"
 
+# pairs of 50bp mates, the second reverse complemented from 150bp after the first
+ref=$(grep -v '>' small/x.fa | tr -d '\n')
+revcomp() { echo $1 | rev | tr ACGT TGCA; }
+quals=$(printf 'I%.0s' $(seq 50))
+fq() { printf "@%s\n%s\n+\n%s\n" $1 $2 $quals; }
+for i in $(seq 0 10 290); do
+    fq p$i/1 ${ref:$i:50}
+    fq p$i/2 $(revcomp ${ref:$((i + 150)):50})
+done >pairs.fq
+# a mate too far from the other to fit the model
+fq far/1 ${ref:300:50} >>pairs.fq
+fq far/2 $(revcomp ${ref:900:50}) >>pairs.fq
+# a mate with every sixth base changed, so none of its kmers are in the index
+fq bad/1 ${ref:320:50} >>pairs.fq
+fq bad/2 $(revcomp ${ref:470:50} | awk '{ for (i = 6; i <= 50; i += 6) $0 = substr($0, 1, i - 1) (substr($0, i, 1) == "A" ? "C" : "A") substr($0, i + 1); print }') >>pairs.fq
+vg map -if pairs.fq -M 20 -t 1 x.vg | vg view -a - >pairs.json
+
+is $(head -60 pairs.json | jq -c .discordant_pair | grep -c true) 0 "pairs that fit the fragment model are not marked discordant"
+
+is $(vg map -if pairs.fq -M 20 -t 1 -D x.vg 2>&1 >/dev/null | grep -c "found mate near first read") 10 \
+   "once the fragment model is learned, mates are found near each other without seeding"
+
+is $(sed -n 61,62p pairs.json | jq -c '[.score, .discordant_pair]' | tr '\n' ' ') "[100,true] [100,true] " \
+   "mates too far apart are each aligned in full and marked discordant"
+
+is $(sed -n 64p pairs.json | jq '.score > 0 and .discordant_pair != true') true \
+   "a mate that can't be seeded is aligned near the other"
+
+# before there's a model, a mate is rescued on whichever strand it aligns
+# to, here forward when the first mate is reverse, as in FR libraries
+mutate() { awk '{ for (i = 6; i <= 50; i += 6) $0 = substr($0, 1, i - 1) (substr($0, i, 1) == "A" ? "C" : "A") substr($0, i + 1); print }'; }
+fq rev/1 $(revcomp ${ref:470:50}) >pairs.fq
+fq rev/2 $(echo ${ref:320:50} | mutate) >>pairs.fq
+is $(vg map -if pairs.fq -M 0 -t 1 x.vg | vg view -a - | sed -n 2p | jq '.score > 0 and (.is_reverse // false) == false') true \
+   "a mate is rescued on the opposite strand to a reverse first mate before the model is ready"
+
+rm -f pairs.fq pairs.json
+
+is $(vg map -s ${ref:100:300} -B 100 x.vg | vg view -a - | jq -c '[.score, ([.path.mapping[].edit[].to_length] | add)]') "[600,300]" \
+   "a long read is aligned in chained pieces that join end to end"
+
+is $(vg map -s ${ref:200:100} -u 2 x.vg | vg view -a - | jq '.score // 0') 200 \
+   "masking low complexity sequence leaves ordinary reads to map"
+
+is $(vg map -s $(printf 'CA%.0s' $(seq 50)) -u 2 x.vg | vg view -a - | jq '.score // 0') 0 \
+   "a read that is all low complexity sequence is not seeded when masking"
+
+insert=ATACCAAAGAACGGATTGCTTATATCGTGCAGAGTTCTGGCACGAGAGCGCCATAGCACG
+is $(vg map -s ${ref:100:150}${insert}${ref:250:150} -B 50 x.vg | vg view -a - | jq -c '[([.path.mapping[].edit[].to_length] | add), .score >= 500]') "[360,true]" \
+   "sequence in a long read that isn't in the graph is kept as an insertion between the pieces around it"
+
+# the reference followed by a second copy of 200bp of it, in small nodes so
+# the copies fall in different clusters
+printf ">dup\n%s%s\n" $ref ${ref:100:200} >dup.fa
+samtools faidx dup.fa
+vg construct -r dup.fa -m 10 >dup.vg
+vg index -s -k 11 dup.vg
+
+is $(vg map -s ${ref:600:100} dup.vg | vg view -a - | jq '.mapping_quality // 0') 60 \
+   "a read from a unique region gets a high mapping quality"
+
+is $(vg map -s ${ref:150:100} dup.vg | vg view -a - | jq '.mapping_quality // 0') 0 \
+   "a read from a duplicated region gets a low mapping quality"
+
+is $(vg map -s ${ref:150:100} -D dup.vg 2>&1 >/dev/null | grep -c "best alignment score 200, second best 200" | awk '{ print ($1 > 0) }') 1 \
+   "both copies of a duplicated region are aligned to"
+
+rm -rf dup.fa dup.fa.fai dup.vg dup.vg.index
+
+# a read changed at every base 2 or 18 mod 20, so each of the kmers taken
+# first, 10bp apart, has a change in it, but half of those 5bp apart don't
+sparse=$(echo ${ref:200:100} | awk '{ for (i = 1; i <= 100; i++) if (i % 20 == 3 || i % 20 == 19) $0 = substr($0, 1, i - 1) (substr($0, i, 1) == "A" ? "C" : "A") substr($0, i + 1); print }')
+is $(vg map -s $sparse -D x.vg 2>&1 >/dev/null | grep -c "realigning with 11 5") 1 \
+   "a read with no kmers found is seeded again at half the stride when there are no shorter kmers to use"
+is $(vg map -s $sparse x.vg | vg view -a - | jq '.score > 0') true \
+   "a read whose kmers are only found at half the stride aligns"
+is $(vg map -s $sparse -L 8 -D x.vg 2>&1 >/dev/null | grep -c "realigning with 8 ") 1 \
+   "lowering --kmer-min lets retries use shorter kmers than the index has"
+
+lowc=$(printf 'CA%.0s' $(seq 50))
+is "$(vg map -s $lowc -u 2 -D x.vg 2>&1 >/dev/null | grep -c "no seeds left worth trying") $(vg map -s $lowc -u 2 -D x.vg 2>&1 >/dev/null | grep -c "realigning")" "1 0" \
+   "a read that is all low complexity sequence is given up on after one attempt"
+
+cp x.vg m.vg
+vg index -s -k 11 m.vg
+vg index -k 15 m.vg
+is $(vg map -s ${ref:200:100} -D m.vg 2>&1 >/dev/null | grep -m 1 '~' | cut -f 1 | awk '{ print length($1) }') 15 \
+   "seeding starts with the largest kmer size in the index"
+rm -rf m.vg m.vg.index
+
+# three copies, the last two apart by more than max_thread_gap nodes of
+# sequence that isn't in the reference forwards
+printf ">tri\n%s%s%s%s\n" $ref ${ref:100:200} $(echo ${ref:400:400} | rev) ${ref:100:200} >tri.fa
+samtools faidx tri.fa
+vg construct -r tri.fa -m 10 >tri.vg
+vg index -s -k 11 tri.vg
+
+is $(vg map -s ${ref:150:100} -D tri.vg 2>&1 >/dev/null | grep -c "skipping cluster" | awk '{ print ($1 > 0) }') 1 \
+   "a cluster that can't beat the two perfect alignments already found isn't aligned"
+
+rm -rf tri.fa tri.fa.fai tri.vg tri.vg.index
+
 rm x.vg
 rm -rf x.vg.index
 
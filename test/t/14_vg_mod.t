@@ -7,7 +7,7 @@ PATH=..:$PATH # for vg
 
 export LC_ALL="en_US.utf8" # force ekg's favorite sort order 
 
-plan tests 9
+plan tests 13
 
 is $(vg construct -r small/x.fa -v small/x.vcf.gz | vg mod -k x - | vg view - | grep ^P | wc -l) \
     $(vg construct -r small/x.fa -v small/x.vcf.gz | vg mod -k x - | vg view - | grep ^S | wc -l) \
@@ -34,3 +34,27 @@ rm -rf t.vg.index
 is $(vg construct -r small/x.fa -v small/x.vcf.gz | vg mod -pl 8 -e 3 - | vg view -g - | sort | md5sum | awk '{ print $1 }') 7c426b504a33ba7985372b978650c3dc "graph complexity reduction works as expected"
 
 is $( vg construct -r small/x.fa -v small/x.vcf.gz | vg mod -pl 8 -e 3 -t 16 - | vg mod -S -l 200 - | vg view - | grep ^S | wc -l) 152 "short subgraph pruning works"
+
+vg construct -r small/x.fa >r.vg
+is $(vg mod -v small/x.vcf.gz r.vg | vg stats -l - | cut -f 2) $(vg construct -r small/x.fa -v small/x.vcf.gz | vg stats -l - | cut -f 2) "variants can be added to an existing graph"
+
+# update an index in place, then rebuild one from scratch for the same graph
+vg index -s -k 11 r.vg
+vg mod -v small/x.vcf.gz -d r.vg.index -C changed.txt r.vg >m.vg
+cp m.vg f.vg
+vg index -s -k 11 f.vg
+
+is $(vg index -D r.vg.index | grep '^{"key":"+g+' | sort | md5sum | awk '{ print $1 }') \
+   $(vg index -D f.vg.index | grep '^{"key":"+g+' | sort | md5sum | awk '{ print $1 }') \
+   "updating the index for added variants stores the same nodes, edges and node paths as a rebuild"
+
+# several hits of a kmer on one node share a key, so compare the keys only
+is $(vg index -D r.vg.index | grep '^{"key":"+k+' | cut -d '"' -f 4 | sort | md5sum | awk '{ print $1 }') \
+   $(vg index -D f.vg.index | grep '^{"key":"+k+' | cut -d '"' -f 4 | sort | md5sum | awk '{ print $1 }') \
+   "updating the index for added variants stores the same kmers as a rebuild"
+
+is $(( $(grep -c ^added changed.txt) - $(grep -c ^removed changed.txt) )) \
+   $(( $(vg view m.vg | grep -c ^S) - $(vg view r.vg | grep -c ^S) )) \
+   "the changed node list accounts for the nodes added and removed"
+
+rm -rf r.vg r.vg.index f.vg f.vg.index m.vg changed.txt
@@ -6,7 +6,7 @@ BASH_TAP_ROOT=../bash-tap
 PATH=..:$PATH # for vg
 
 
-plan tests 8
+plan tests 9
 
 vg construct -r small/x.fa >j.vg
 vg construct -r small/x.fa -v small/x.vcf.gz >x.vg
@@ -27,6 +27,12 @@ is $(vg map -r <(vg sim -s 1337 -n 100 x.vg) x.vg | vg surject -p x -d x.vg.inde
 #is $(vg map -r <(vg sim -s 1337 -n 100 x.vg) x.vg | vg surject -p x -d x.vg.index -c - | samtools view - | wc -l) \
 #    100 "vg surject produces valid CRAM output"
 
+vg map -r <(vg sim -s 1337 -n 100 j.vg) x.vg >j.gam
+is $(vg surject -p x -d x.vg.index -t 1 -s j.gam | grep -v ^@ | cut -f 1,3,4,6 | md5sum | cut -f 1 -d\ ) \
+    $(vg surject -p x -d x.vg.index -t 1 -s -r j.gam | grep -v ^@ | cut -f 1,3,4,6 | md5sum | cut -f 1 -d\ ) \
+    "reads read off the path are placed as they are when realigned"
+rm -f j.gam
+
 rm -rf j.vg x.vg x.vg.index
 
 vg index -s -k 27 -e 7 graphs/fail.vg
@@ -0,0 +1,30 @@
+#include <iostream>
+#include <cmath>
+#include <cstdlib>
+#include "entropy.hpp"
+
+using namespace std;
+using namespace vg;
+
+// print the number of windows of the given size along the sequence, and how
+// many of them window_entropies gets a different entropy for than entropy()
+int main(int argc, char *argv[])
+{
+    if (argc != 3) {
+        cerr << "usage: " << argv[0] << " <sequence> <window>" << endl;
+        return 1;
+    }
+    string seq = argv[1];
+    int window = atoi(argv[2]);
+
+    vector<double> entropies;
+    window_entropies(seq, window, entropies);
+
+    int different = 0;
+    for (size_t i = 0; i < entropies.size(); ++i) {
+        if (fabs(entropies[i] - entropy(seq.substr(i, window))) > 1e-9) ++different;
+    }
+    cout << entropies.size() << " " << different << endl;
+
+    return 0;
+}
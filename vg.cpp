@@ -1,5 +1,8 @@
 #include "vg.hpp"
 #include "stream.hpp"
+#include <unordered_set>
+#include <queue>
+#include <tuple>
 
 namespace vg {
 
@@ -95,7 +98,6 @@ void VG::serialize_to_file(const string& file_name, int64_t chunk_size) {
 }
 
 VG::~VG(void) {
-    destroy_alignable_graph();
 }
 
 VG::VG(void) {
@@ -103,7 +105,6 @@ VG::VG(void) {
 }
 
 void VG::init(void) {
-    gssw_aligner = NULL;
     current_id = 1;
     show_progress = false;
     progress_message = "progress";
@@ -486,6 +487,78 @@ void VG::append(VG& g) {
     paths.append(g.paths);
 }
 
+void VG::append_chunks(vector<VG*>& chunks) {
+    int n = chunks.size();
+    // the heads and tails which append() would join between each pair of chunks
+    vector<vector<int64_t> > heads(n), tails(n);
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int i = 0; i < n; ++i) {
+        for (Node* h : chunks[i]->head_nodes()) heads[i].push_back(h->id());
+        for (Node* t : chunks[i]->tail_nodes()) tails[i].push_back(t->id());
+    }
+
+    // work out where each chunk goes, and how far its ids must move to get
+    // out of the way of the chunks before it
+    vector<int64_t> id_offset(n), node_offset(n), edge_offset(n);
+    int64_t max_id = 0, node_total = 0, edge_total = 0;
+    for (int i = 0; i < n; ++i) {
+        id_offset[i] = max_id;
+        node_offset[i] = node_total;
+        edge_offset[i] = edge_total;
+        max_id += chunks[i]->max_node_id();
+        node_total += chunks[i]->graph.node_size();
+        edge_total += chunks[i]->graph.edge_size();
+        if (i > 0) edge_total += tails[i-1].size() * heads[i].size();
+    }
+
+    // size the graph up front so the chunks can be moved in concurrently
+    graph.mutable_node()->Reserve(node_total);
+    for (int64_t i = 0; i < node_total; ++i) graph.add_node();
+    graph.mutable_edge()->Reserve(edge_total);
+    for (int64_t i = 0; i < edge_total; ++i) graph.add_edge();
+
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int i = 0; i < n; ++i) {
+        Graph& g = chunks[i]->graph;
+        int64_t offset = id_offset[i];
+        for (int j = 0; j < g.node_size(); ++j) {
+            Node* node = graph.mutable_node(node_offset[i] + j);
+            node->Swap(g.mutable_node(j));
+            node->set_id(node->id() + offset);
+        }
+        int64_t k = edge_offset[i];
+        for (int j = 0; j < g.edge_size(); ++j) {
+            Edge* edge = graph.mutable_edge(k++);
+            edge->Swap(g.mutable_edge(j));
+            edge->set_from(edge->from() + offset);
+            edge->set_to(edge->to() + offset);
+        }
+        // the edges from the last chunk follow ours, as append() would add them
+        if (i > 0) {
+            for (auto tail : tails[i-1]) {
+                for (auto head : heads[i]) {
+                    Edge* edge = graph.mutable_edge(k++);
+                    edge->set_from(tail + id_offset[i-1]);
+                    edge->set_to(head + offset);
+                }
+            }
+        }
+        chunks[i]->paths.for_each_mapping([offset](Mapping* m) {
+                m->mutable_position()->set_node_id(m->position().node_id() + offset);
+            });
+    }
+
+    // join paths that are embedded in the graphs, where path names are the same
+    for (auto chunk : chunks) {
+        for (auto& p : chunk->paths._paths) {
+            list<Mapping>& path = paths.get_create_path(p.first);
+            path.splice(path.end(), p.second);
+        }
+    }
+
+    rebuild_indexes();
+}
+
 void VG::combine(VG& g) {
     // compact and increment the ids of g out of range of this graph
     //g.compact_ids();
@@ -1110,8 +1183,6 @@ VG::VG(vcflib::VariantCallFile& variantCallFile,
 
     show_progress = showprog;
 
-    map<string, VG*> refseq_graph;
-
     vector<string> targets;
     if (!target_region.empty()) {
         targets.push_back(target_region);
@@ -1134,38 +1205,20 @@ VG::VG(vcflib::VariantCallFile& variantCallFile,
     //
     //
 
+    // the construction plans for all targets, in order, so that the chunks of
+    // every target are built from a single work queue
+    vector<Plan*> construction;
+    // the range of plans in construction that belongs to each target
+    vector<pair<int, int> > target_plans;
+
     for (vector<string>::iterator t = targets.begin(); t != targets.end(); ++t) {
 
         //string& seq_name = *t;
         string seq_name;
         string target = *t;
         int start_pos = 0, stop_pos = 0;
-        // nasty hack for handling single regions
-        if (!target_is_chrom) {
-            parse_region(target,
-                         seq_name,
-                         start_pos, 
-                         stop_pos);
-            if (stop_pos > 0) {
-                if (variantCallFile.is_open()) {
-                    variantCallFile.setRegion(seq_name, start_pos, stop_pos);
-                }
-            } else {
-                if (variantCallFile.is_open()) {
-                    variantCallFile.setRegion(seq_name);
-                }
-                stop_pos = reference.sequenceLength(seq_name);
-            }
-        } else {
-            // the user said the target is just a sequence name
-            // and is unsafe to parse as it may contain ':' or '-'
-            // for example "gi|568815592:29791752-29792749"
-            if (variantCallFile.is_open()) {
-                variantCallFile.setRegion(target);
-            }
-            stop_pos = reference.sequenceLength(target);
-            seq_name = target;
-        }
+        set_construction_target(variantCallFile, reference, target, target_is_chrom,
+                                seq_name, start_pos, stop_pos);
         vcflib::Variant var(variantCallFile);
 
         vector<vcflib::Variant>* region = NULL;
@@ -1203,20 +1256,7 @@ VG::VG(vcflib::VariantCallFile& variantCallFile,
         // even pieces that would be smaller than the max
         slice_alleles(alleles, start_pos, stop_pos, max_node_size);
 
-        // store our construction plans
-        deque<Plan*> construction;
-        // so we can check which graphs we can safely append
-        set<VG*> graph_completed;
-        // we add and remove from graph_completed, so track count for logging
-        int graphs_completed = 0;
-        int final_completed = -1; // hm
-        // the construction queue
-        list<VG*> graphq;
-        int graphq_size = 0; // for efficiency
-        // ^^^^ (we need to insert/remove things in the middle of the list,
-        // but we also need to be able to quickly determine its size)
-        // for tracking progress through the chromosome
-        map<VG*, unsigned long> graph_end;
+        int first_plan = construction.size();
 
         create_progress("planning construction", stop_pos-start_pos);
         // break into chunks
@@ -1258,168 +1298,345 @@ VG::VG(vcflib::VariantCallFile& variantCallFile,
             // record end position, use target end in the case that we are at the end
             if (alleles.empty()) chunk_end = stop_pos;
 
-            // we set the head graph to be this one, so we aren't obligated to copy the result into this object
             // make a construction plan
-            Plan* plan = new Plan(graphq.empty() && targets.size() == 1 ? this : new VG,
+            Plan* plan = new Plan(new VG,
                                   new_alleles,
                                   reference.getSubSequence(seq_name,
                                                            chunk_start,
                                                            chunk_end - chunk_start),
                                   seq_name);
             chunk_start = chunk_end;
-#pragma omp critical (graphq)
-            {
-                graphq.push_back(plan->graph);
-                construction.push_back(plan);
-                if (show_progress) graph_end[plan->graph] = chunk_end;
-                update_progress(chunk_end);
-            }
+            construction.push_back(plan);
+            update_progress(chunk_end);
         }
-#ifdef debug
-        cerr << omp_get_thread_num() << ": graphq size " << graphq.size() << endl;
-#endif
-        graphq_size = graphq.size();
+        target_plans.push_back(make_pair(first_plan, (int)construction.size()));
         destroy_progress();
+    }
 
-        // this system is not entirely general
-        // there will be a problem when the regions of overlapping deletions become too large
-        // then the inter-dependence of each region will make parallel construction in this way difficult
-        // because the chunks will get too large
-
-        // use this function to merge graphs both during and after the construction iteration
-        auto merge_first_two_completed_graphs =
-            [this, start_pos, &graph_completed, &graphq, &graphq_size, &graph_end, &final_completed](void) {
-            // find the first two consecutive graphs which are completed
-            VG* first = NULL;
-            VG* second = NULL;
-//#pragma omp critical (cerr)
-//            cerr << omp_get_thread_num() << ": merging" << endl;
-#pragma omp critical (graphq)
-            {
-                auto itp = graphq.begin(); // previous
-                auto itn = itp; if (itp != graphq.end()) ++itn; // next
-                // scan the graphq to find consecutive entries that are both completed
-                while (itp != itn // there is > 1 entry
-                       && itn != graphq.end() // we aren't yet at the end
-                       && !(graph_completed.count(*itp) // the two we're looking at aren't completed
-                            && graph_completed.count(*itn))) {
-                    ++itp; ++itn;
-                }
-
-                if (itn != graphq.end()) {
-                    // we have two consecutive graphs to merge!
-                    first = *itp;
-                    second = *itn;
-                    // unset graph completed for both
-                    graph_completed.erase(first);
-                    graph_completed.erase(second);
-                    graphq.erase(itn);
-                    --graphq_size;
-                }
-            }
+    // this system is not entirely general
+    // there will be a problem when the regions of overlapping deletions become too large
+    // then the inter-dependence of each region will make parallel construction in this way difficult
+    // because the chunks will get too large
 
-            if (first && second) {
-                // combine graphs
-                first->append(*second);
-#pragma omp critical (graphq)
-                {
-                    if (final_completed != -1) update_progress(final_completed++);
-                    graph_completed.insert(first);
-                    graph_end.erase(second);
-                }
-                delete second;
-            }
-        };
+    // the graphs we build, in the order of the plans
+    vector<VG*> graphs(construction.size());
+    int graphs_completed = 0;
 
-        create_progress("constructing graph", construction.size());
+    create_progress("constructing graph", construction.size());
 
-        // (in parallel) construct each component of the graph
-#pragma omp parallel for
-        for (int i = 0; i < construction.size(); ++i) {
+    // (in parallel) construct each component of the graph, across all targets
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int i = 0; i < construction.size(); ++i) {
 
-            int tid = omp_get_thread_num();
-            Plan* plan = construction.at(i);
+        int tid = omp_get_thread_num();
+        Plan* plan = construction.at(i);
 #ifdef debug
 #pragma omp critical (cerr)
-            cerr << tid << ": " << "constructing graph " << plan->graph << " over "
-                 << plan->alleles->size() << " variants in " <<plan->seq.size() << "bp "
-                 << plan->name << endl;
+        cerr << tid << ": " << "constructing graph " << plan->graph << " over "
+             << plan->alleles->size() << " variants in " <<plan->seq.size() << "bp "
+             << plan->name << endl;
 #endif
 
-            plan->graph->from_alleles(*plan->alleles,
-                                      plan->seq,
-                                      plan->name);
+        plan->graph->from_alleles(*plan->alleles,
+                                  plan->seq,
+                                  plan->name);
+        graphs[i] = plan->graph;
+        // clean up
+        delete plan;
 #pragma omp critical (graphq)
-            {
-                update_progress(++graphs_completed);
-                graph_completed.insert(plan->graph);
-#ifdef debug
-#pragma omp critical (cerr)
-                cerr << tid << ": " << "constructed graph " << plan->graph << endl;
-#endif
-            }
-            // clean up
-            delete plan;
+        update_progress(++graphs_completed);
+    }
+    destroy_progress();
+
+    // Concatenate the chunks of each target together in order, in one pass
+    // per target. When we have a single target we build it in this graph, so
+    // we aren't obligated to copy the result into this object.
+    vector<VG*> target_graphs;
+    create_progress("merging graphs", target_plans.size());
+    for (int i = 0; i < target_plans.size(); ++i) {
+        VG* target_graph = target_plans.size() == 1 ? this : new VG;
+        vector<VG*> chunks(graphs.begin() + target_plans[i].first,
+                           graphs.begin() + target_plans[i].second);
+        target_graph->name = chunks.front()->name;
+        target_graph->append_chunks(chunks);
+        for (auto g : chunks) {
+            delete g;
+        }
+        target_graphs.push_back(target_graph);
+        update_progress(i + 1);
+    }
+    destroy_progress();
 
-            // concatenate chunks of the result graph together
-            merge_first_two_completed_graphs();
+    auto finish_target = [](VG* target_graph) {
+        // clean up "null" nodes that are used for maintaining structure between temporary subgraphs
+        target_graph->remove_null_nodes_forwarding_edges();
+        // then use topological sorting and re-compression of the id space to make sure that
+        // we get identical graphs no matter what the region size is
+        target_graph->sort();
+        target_graph->compact_ids();
+    };
 
+    // hack for efficiency when constructing over a single chromosome
+    if (target_graphs.size() == 1) {
+        // we have already built the target in this graph
+        create_progress("finishing graph", size());
+        finish_target(this);
+        destroy_progress();
+    } else {
+        // where we have multiple targets, finish them in parallel
+        int targets_completed = 0;
+        create_progress("finishing graphs", target_graphs.size());
+#pragma omp parallel for schedule(dynamic, 1)
+        for (int i = 0; i < target_graphs.size(); ++i) {
+            finish_target(target_graphs[i]);
+#pragma omp critical (graphq)
+            update_progress(++targets_completed);
         }
         destroy_progress();
+        for (auto g : target_graphs) {
+            // merge the variants into one graph
+            combine(*g);
+            delete g;
+        }
+    }
+}
 
-        // merge remaining graphs
-        final_completed = 0;
-        create_progress("merging remaining graphs", graphq.size());
-#pragma omp parallel
-        {
-            bool more_to_merge = true;
-            while (more_to_merge) {
-                merge_first_two_completed_graphs();
-                usleep(10);
-#pragma omp critical (graphq)
-                more_to_merge = graphq_size > 1;
+void VG::set_construction_target(vcflib::VariantCallFile& variantCallFile,
+                                 FastaReference& reference,
+                                 string& target,
+                                 bool target_is_chrom,
+                                 string& seq_name,
+                                 int& start_pos,
+                                 int& stop_pos) {
+    start_pos = 0;
+    stop_pos = 0;
+    // nasty hack for handling single regions
+    if (!target_is_chrom) {
+        parse_region(target,
+                     seq_name,
+                     start_pos, 
+                     stop_pos);
+        if (stop_pos > 0) {
+            if (variantCallFile.is_open()) {
+                variantCallFile.setRegion(seq_name, start_pos, stop_pos);
+            }
+        } else {
+            if (variantCallFile.is_open()) {
+                variantCallFile.setRegion(seq_name);
             }
+            stop_pos = reference.sequenceLength(seq_name);
         }
-        destroy_progress();
+    } else {
+        // the user said the target is just a sequence name
+        // and is unsafe to parse as it may contain ':' or '-'
+        // for example "gi|568815592:29791752-29792749"
+        if (variantCallFile.is_open()) {
+            variantCallFile.setRegion(target);
+        }
+        stop_pos = reference.sequenceLength(target);
+        seq_name = target;
+    }
+}
 
-        // parallel end
-        // finalize target
+void VG::construct_streaming(vcflib::VariantCallFile& variantCallFile,
+                             FastaReference& reference,
+                             string& target_region,
+                             bool target_is_chrom,
+                             int vars_per_region,
+                             int max_node_size,
+                             function<void(Graph&, uint64_t)>& emit) {
 
-        // our target graph should be the only entry in the graphq
-        assert(graphq.size() == 1);
-        VG* target_graph = graphq.front();
+    vector<string> targets;
+    if (!target_region.empty()) {
+        targets.push_back(target_region);
+    } else {
+        for (vector<string>::iterator r = reference.index->sequenceNames.begin();
+             r != reference.index->sequenceNames.end(); ++r) {
+            targets.push_back(*r);
+        }
+    }
 
-        // store it in our results
-        refseq_graph[target] = target_graph;
+    // how many chunks we build at once, this bounds our memory use
+    int batch_size = omp_get_max_threads() * 4;
+    // ids are assigned in order across all chunks of all targets
+    int64_t id_offset = 0;
+    uint64_t chunk_id = 0;
 
-        create_progress("joining graphs", target_graph->size());
-        // clean up "null" nodes that are used for maintaining structure between temporary subgraphs
-        target_graph->remove_null_nodes_forwarding_edges();
-        destroy_progress();
+    for (auto& target : targets) {
 
-        // then use topological sorting and re-compression of the id space to make sure that
-        create_progress("topologically sorting", target_graph->size());
-        target_graph->sort();
-        destroy_progress();
+        string seq_name;
+        int start_pos = 0, stop_pos = 0;
+        set_construction_target(variantCallFile, reference, target, target_is_chrom,
+                                seq_name, start_pos, stop_pos);
+        vcflib::Variant var(variantCallFile);
 
-        create_progress("compacting ids", target_graph->size());
-        // we get identical graphs no matter what the region size is
-        target_graph->compact_ids();
-        destroy_progress();
+        // convert from 1-based input to 0-based internal format
+        long chunk_start = start_pos ? start_pos - 1 : 0;
+        // the window of variants we have read but not yet put into a chunk
+        map<long, set<vcflib::VariantAllele> > alleles;
+        bool more_variants = variantCallFile.is_open();
+        long last_read = chunk_start;
+        // the tails of the last chunk, to be joined to the heads of the next
+        vector<int64_t> prev_tails;
+
+        auto read_variants = [&](int count) {
+            for (int i = 0; i < count && more_variants; ++i) {
+                if (!variantCallFile.getNextVariant(var)) {
+                    more_variants = false;
+                    break;
+                }
+                bool isDNA = allATGC(var.ref);
+                for (vector<string>::iterator a = var.alt.begin(); a != var.alt.end(); ++a) {
+                    if (!allATGC(*a)) isDNA = false;
+                }
+                // only work with DNA sequences
+                if (!isDNA) continue;
+                var.position -= 1; // convert to 0-based
+                last_read = var.position;
+                for (auto& alts : var.parsedAlternates()) {
+                    for (auto& allele : alts.second) {
+                        alleles[allele.position].insert(allele);
+                    }
+                }
+            }
+        };
 
-    }
+        // Cut the next chunk off the front of the window, as the constructor
+        // above does. Returns NULL if we can't yet be sure where the chunk ends.
+        auto next_chunk = [&](bool& last) -> Plan* {
+            bool at_end = !more_variants;
+            auto a = alleles.begin();
+            long chunk_end = chunk_start;
+            bool clean_end = true;
+            for (int i = 0; (i < vars_per_region || !clean_end) && a != alleles.end(); ++i) {
+                chunk_end = max(chunk_end, a->first);
+                for (auto& allele : a->second) {
+                    chunk_end = max(chunk_end, (long) (allele.position + allele.ref.size()));
+                }
+                ++a;
+                clean_end = a != alleles.end() && a->first > chunk_end;
+            }
+            // variants we have yet to read could overlap the end of the chunk
+            if (!at_end && (!clean_end || chunk_end >= last_read)) {
+                return NULL;
+            }
+            last = at_end && a == alleles.end();
+            if (last) chunk_end = stop_pos;
+            VG* graph = new VG;
+            auto* chunk_alleles = new map<long, set<vcflib::VariantAllele> >;
+            map<long, set<vcflib::VariantAllele> > window(alleles.begin(), a);
+            alleles.erase(alleles.begin(), a);
+            // the chunk's graph does the slicing so we don't show its progress
+            graph->slice_alleles(window, chunk_start, chunk_end, max_node_size);
+            for (auto& pos_alleles : window) {
+                long pos = pos_alleles.first - chunk_start;
+                // we can't cut at the very start of the chunk
+                if (!pos && pos_alleles.second.empty()) continue;
+                auto& curr_pos = (*chunk_alleles)[pos];
+                for (auto& allele : pos_alleles.second) {
+                    auto new_allele = allele;
+                    new_allele.position = pos;
+                    curr_pos.insert(new_allele);
+                }
+            }
+            Plan* plan = new Plan(graph,
+                                  chunk_alleles,
+                                  reference.getSubSequence(seq_name,
+                                                           chunk_start,
+                                                           chunk_end - chunk_start),
+                                  seq_name);
+            chunk_start = chunk_end;
+            return plan;
+        };
 
-    // hack for efficiency when constructing over a single chromosome
-    if (refseq_graph.size() == 1) {
-        // *this = *refseq_graph[targets.front()];
-        // we have already done this because the first graph in the queue is this
-    } else {
-        // where we have multiple targets
-        for (vector<string>::iterator t = targets.begin(); t != targets.end(); ++t) {
-            // merge the variants into one graph
-            VG& g = *refseq_graph[*t];
-            combine(g);
+        // build the planned chunks in parallel, give them their ids in order,
+        // join them up and pass them on
+        auto build_chunks = [&](vector<Plan*>& plans) {
+            int n = plans.size();
+            vector<vector<int64_t> > heads(n), tails(n);
+#pragma omp parallel for schedule(dynamic, 1)
+            for (int i = 0; i < n; ++i) {
+                Plan* plan = plans[i];
+                VG& g = *plan->graph;
+                g.from_alleles(*plan->alleles, plan->seq, plan->name);
+                // from_alleles anchors variation at the ends of the sequence on
+                // empty nodes, so the real ends of the chunk are next to them
+                set<Node*> chunk_heads, chunk_tails;
+                for (Node* h : g.head_nodes()) {
+                    if (!h->sequence().empty()) {
+                        chunk_heads.insert(h);
+                    } else {
+                        for (auto& e : g.edges_end(h)) {
+                            Node* n = g.get_node(e.first);
+                            if (!n->sequence().empty()) chunk_heads.insert(n);
+                        }
+                    }
+                }
+                for (Node* t : g.tail_nodes()) {
+                    if (!t->sequence().empty()) {
+                        chunk_tails.insert(t);
+                    } else {
+                        for (auto& e : g.edges_start(t)) {
+                            Node* n = g.get_node(e.first);
+                            if (!n->sequence().empty()) chunk_tails.insert(n);
+                        }
+                    }
+                }
+                // the empty nodes go, as remove_null_nodes_forwarding_edges
+                // would do for the whole graph, and we restore the order
+                g.remove_null_nodes_forwarding_edges();
+                g.sort();
+                g.compact_ids();
+                for (Node* h : chunk_heads) heads[i].push_back(h->id());
+                for (Node* t : chunk_tails) tails[i].push_back(t->id());
+            }
+            // each chunk's ids follow on from the last
+            vector<int64_t> offsets(n);
+            vector<vector<int64_t> > joins(n);
+            for (int i = 0; i < n; ++i) {
+                offsets[i] = id_offset;
+                joins[i] = prev_tails;
+                if (!tails[i].empty()) {
+                    prev_tails.clear();
+                    for (auto t : tails[i]) prev_tails.push_back(t + id_offset);
+                }
+                id_offset += plans[i]->graph->node_count();
+            }
+#pragma omp parallel for schedule(dynamic, 1)
+            for (int i = 0; i < n; ++i) {
+                Plan* plan = plans[i];
+                VG& g = *plan->graph;
+                g.increment_node_ids(offsets[i]);
+                // the edges into the chunk from the last one are carried by this chunk
+                for (auto t : joins[i]) {
+                    for (auto h : heads[i]) {
+                        g.create_edge(t, h + offsets[i]);
+                    }
+                }
+                g.paths.to_graph(g.graph);
+                emit(g.graph, chunk_id + i);
+                delete plan->graph;
+                delete plan;
+            }
+            chunk_id += n;
+            plans.clear();
+        };
+
+        create_progress("constructing " + target, stop_pos - start_pos);
+        vector<Plan*> plans;
+        bool last = false;
+        while (!last) {
+            Plan* plan = NULL;
+            while (!(plan = next_chunk(last))) {
+                read_variants(vars_per_region);
+            }
+            plans.push_back(plan);
+            if (plans.size() == batch_size || last) {
+                build_chunks(plans);
+                update_progress(chunk_start - start_pos);
+            }
         }
+        destroy_progress();
     }
 }
 
@@ -1428,12 +1645,29 @@ void VG::sort(void) {
     // Topologically sort, which orders and orients all the nodes.
     deque<NodeTraversal> sorted_nodes;
     topological_sort(sorted_nodes);
-    deque<NodeTraversal>::iterator n = sorted_nodes.begin();
-    int i = 0;
-    for ( ; i < graph.node_size() && n != sorted_nodes.end();
-          ++i, ++n) {
-        // Put the nodes in the order we got
-        swap_nodes(graph.mutable_node(i), (*n).node);
+    // Put the nodes in the order we got, keeping track of where each one is
+    // by its place in that order so we don't go back to the index per swap.
+    int64_t count = min((int64_t) graph.node_size(), (int64_t) sorted_nodes.size());
+    vector<int64_t> place_of(count);
+    vector<int64_t> sorted_at(graph.node_size(), -1);
+    for (int64_t k = 0; k < count; ++k) {
+        place_of[k] = node_index[sorted_nodes[k].node];
+        sorted_at[place_of[k]] = k;
+    }
+    for (int64_t i = 0; i < count; ++i) {
+        int64_t j = place_of[i];
+        if (j != i) {
+            graph.mutable_node()->SwapElements(i, j);
+            // whatever was here is now where our node was
+            int64_t k = sorted_at[i];
+            if (k >= 0) place_of[k] = j;
+            sorted_at[j] = k;
+            place_of[i] = i;
+            sorted_at[i] = i;
+        }
+    }
+    for (int64_t i = 0; i < graph.node_size(); ++i) {
+        node_index[graph.mutable_node(i)] = i;
     }
 }
 
@@ -1781,7 +2015,7 @@ void VG::node_context(Node* node, VG& g) {
     if (paths.has_node_mapping(node)) {
         auto& node_mappings = paths.get_node_mapping(node);
         for (auto& i : node_mappings) {
-            g.paths.append_mapping(i.first, *i.second);
+            g.paths.append_mapping(paths.get_path_name(i.first), *i.second);
         }
     }
 }
@@ -1814,7 +2048,7 @@ void VG::nonoverlapping_node_context(Node* node, VG& g) {
     if (paths.has_node_mapping(node)) {
         auto& node_mappings = paths.get_node_mapping(node);
         for (auto& i : node_mappings) {
-            g.paths.append_mapping(i.first, *i.second);
+            g.paths.append_mapping(paths.get_path_name(i.first), *i.second);
         }
     }
 }
@@ -1935,7 +2169,8 @@ void VG::remove_node_forwarding_edges(Node* node) {
 
     // remove the node from paths
     if (paths.has_node_mapping(node)) {
-        auto& node_mappings = paths.get_node_mapping(node);
+        // copy, as removing the mappings modifies the node's entry
+        auto node_mappings = paths.get_node_mapping(node);
         for (auto& p : node_mappings) {
             paths.remove_mapping(p.second);
         }
@@ -1986,11 +2221,12 @@ void VG::keep_paths(set<string>& path_names, set<string>& kept_names) {
         if(paths.has_node_mapping(node)) {
             // This node appears on some paths. Look for appearances on paths we like.
             for(auto& appearance : paths.get_node_mapping(node)) {
-                if(path_names.count(appearance.first)) {
+                const string& appearance_name = paths.get_path_name(appearance.first);
+                if(path_names.count(appearance_name)) {
                     // We found an appearance of this node on a path we are keeping. It comes with a Mapping*.
 
                     // Mark the path and node as kept
-                    kept_names.insert(appearance.first);
+                    kept_names.insert(appearance_name);
                     to_keep = true;
 
                     // Walk left along the path and keep the edge we traverse.
@@ -2119,9 +2355,7 @@ void VG::divide_node(Node* node, int pos, Node*& left, Node*& right) {
         // apply to left and right
         vector<Mapping*> to_divide;
         for (auto& pm : node_path_mapping) {
-            string path_name = pm.first;
-            Mapping* m = pm.second;
-            to_divide.push_back(m);
+            to_divide.push_back(pm.second);
         }
         for (auto m : to_divide) {
             // we have to divide the mapping
@@ -2198,77 +2432,101 @@ int VG::node_count_next(NodeTraversal n) {
     return nodes.size();
 }
 
-void VG::prev_kpaths_from_node(NodeTraversal node, int length, int edge_max, bool edge_bounding,
-                               list<NodeTraversal> postfix, set<list<NodeTraversal> >& paths,
-                               function<void(NodeTraversal)>& maxed_nodes) {
-    if (length == 0) return;
-    if (edge_bounding && edge_max <= 0) {
-        // We recursed in here and hit the max edge depth. Complain to the caller.
-        maxed_nodes(node);
-        return;
-    }
-    // start at node
-    // do a leftward DFS up to length limit to establish paths from the left of the node
-    postfix.push_front(node);
-    // Get all the nodes left of this one
-    vector<NodeTraversal> prev_nodes;
-    nodes_prev(node, prev_nodes);
-    if (prev_nodes.empty()) {
-        // We can't go any lefter, so we produce this as a path
-        list<NodeTraversal> new_path = postfix;
-        paths.insert(new_path);
-    } // implicit else
-    for (NodeTraversal& prev : prev_nodes) {
-        if (prev.node->sequence().size() < length) {
-            prev_kpaths_from_node(prev,
-                                  length - prev.node->sequence().size(),
-                                  // Charge 1 against edge_max for every alternative edge we passed up
-                                  edge_max - max(left_degree(node)-1, 0),
-                                  // but only if we are using edge bounding
-                                  edge_bounding,
-                                  postfix, paths, maxed_nodes);
+void VG::kpath_extensions(NodeTraversal node, int length, int edge_max, bool edge_bounding, bool go_left,
+                          function<void(NodeTraversal)>& maxed_nodes,
+                          vector<NodeTraversal>& stack,
+                          const function<void(vector<NodeTraversal>&)>& lambda) {
+    // A step of the walk: the node on top of the stack, how far we may still
+    // go past it, what is left of our edge budget after leaving it, and the
+    // next of its neighbors to try.
+    struct Frame {
+        NodeTraversal node;
+        int length;
+        int edge_max;
+        size_t next;
+    };
+    vector<Frame> frames;
+    stack.clear();
+
+    // the sides of the nodes we can step to from this one, in the direction we're going
+    auto neighbors = [this, go_left](const NodeTraversal& n) -> vector<pair<int64_t, bool>>& {
+        return (go_left != n.backward) ? edges_start(n.node) : edges_end(n.node);
+    };
+
+    auto enter = [&](NodeTraversal n, int length, int edge_max) {
+        if (length == 0) return;
+        if (edge_bounding && edge_max <= 0) {
+            // We hit the max edge depth. Complain to the caller.
+            maxed_nodes(n);
+            return;
+        }
+        stack.push_back(n);
+        auto& sides = neighbors(n);
+        if (sides.empty()) {
+            // We can't go any further, so we produce this as a path
+            lambda(stack);
+        }
+        // Charge 1 against edge_max for every alternative edge we pass up
+        int degree = go_left ? left_degree(n) : right_degree(n);
+        frames.push_back(Frame{n, length, edge_max - max(degree - 1, 0), 0});
+    };
+
+    enter(node, length, edge_max);
+    while (!frames.empty()) {
+        Frame& frame = frames.back();
+        auto& sides = neighbors(frame.node);
+        if (frame.next == sides.size()) {
+            frames.pop_back();
+            stack.pop_back();
+            continue;
+        }
+        size_t i = frame.next++;
+        // if there are two edges to the same side, only follow the first
+        bool repeated = false;
+        for (size_t j = 0; j < i; ++j) {
+            if (sides[j] == sides[i]) repeated = true;
+        }
+        if (repeated) continue;
+        // If we're backward, and it's in the same relative orientation as us, it needs to be backward too.
+        NodeTraversal other(get_node(sides[i].first), sides[i].second != frame.node.backward);
+        int other_length = other.node->sequence().size();
+        if (other_length < frame.length) {
+            // enter may grow frames, so take what we need from this frame first
+            int remaining = frame.length - other_length;
+            int budget = frame.edge_max;
+            enter(other, remaining, budget);
         } else {
-            // create a path for this node
-            list<NodeTraversal> new_path = postfix;
-            new_path.push_front(prev);
-            paths.insert(new_path);
+            // create a path ending at this node
+            stack.push_back(other);
+            lambda(stack);
+            stack.pop_back();
         }
     }
 }
 
+void VG::prev_kpaths_from_node(NodeTraversal node, int length, int edge_max, bool edge_bounding,
+                               const list<NodeTraversal>& postfix, set<list<NodeTraversal> >& paths,
+                               function<void(NodeTraversal)>& maxed_nodes) {
+    vector<NodeTraversal> stack;
+    kpath_extensions(node, length, edge_max, edge_bounding, true, maxed_nodes, stack,
+                     [&postfix, &paths](vector<NodeTraversal>& prev) {
+                         // the stack runs leftward from the node, so the path is its reverse
+                         list<NodeTraversal> path(prev.rbegin(), prev.rend());
+                         path.insert(path.end(), postfix.begin(), postfix.end());
+                         paths.insert(path);
+                     });
+}
+
 void VG::next_kpaths_from_node(NodeTraversal node, int length, int edge_max, bool edge_bounding,
-                               list<NodeTraversal> prefix, set<list<NodeTraversal> >& paths,
+                               const list<NodeTraversal>& prefix, set<list<NodeTraversal> >& paths,
                                function<void(NodeTraversal)>& maxed_nodes) {
-    if (length == 0) return;
-    if (edge_bounding && edge_max <= 0) {
-        maxed_nodes(node);
-        return;
-    }
-    // start at node
-    // do a leftward DFS up to length limit to establish paths from the left of the node
-    prefix.push_back(node);
-    vector<NodeTraversal> next_nodes;
-    nodes_next(node, next_nodes);
-    if (next_nodes.empty()) {
-        list<NodeTraversal> new_path = prefix;
-        paths.insert(new_path);
-    } // implicit else
-    for (NodeTraversal& next : next_nodes) {
-        if (next.node->sequence().size() < length) {
-            next_kpaths_from_node(next,
-                                  length - next.node->sequence().size(),
-                                  // Charge 1 against edge_max for every alternative edge we passed up
-                                  edge_max - max(right_degree(node)-1, 0),
-                                  // but only if we are using edge bounding
-                                  edge_bounding,
-                                  prefix, paths, maxed_nodes);
-        } else {
-            // create a path for this node
-            list<NodeTraversal> new_path = prefix;
-            new_path.push_back(next);
-            paths.insert(new_path);
-        }
-    }
+    vector<NodeTraversal> stack;
+    kpath_extensions(node, length, edge_max, edge_bounding, false, maxed_nodes, stack,
+                     [&prefix, &paths](vector<NodeTraversal>& next) {
+                         list<NodeTraversal> path(prefix);
+                         path.insert(path.end(), next.begin(), next.end());
+                         paths.insert(path);
+                     });
 }
 
 // iterate over the kpaths in the graph, doing something
@@ -2342,33 +2600,48 @@ void VG::for_each_kpath_of_node(Node* node, int k, int edge_max,
                                 function<void(NodeTraversal)> prev_maxed,
                                 function<void(NodeTraversal)> next_maxed,
                                 function<void(list<NodeTraversal>::iterator,list<NodeTraversal>&)> lambda) {
-    // get left, then right
-    set<list<NodeTraversal> > prev_paths;
-    set<list<NodeTraversal> > next_paths;
-    list<NodeTraversal> empty_list;
-    
-    prev_kpaths_from_node(NodeTraversal(node), k, edge_max, (edge_max != 0),
-                          empty_list, prev_paths, prev_maxed);
-    next_kpaths_from_node(NodeTraversal(node), k, edge_max, (edge_max != 0),
-                          empty_list, next_paths, next_maxed);
-    // now take the cross and give to the callback
-    for (set<list<NodeTraversal> >::iterator p = prev_paths.begin(); p != prev_paths.end(); ++p) {
-        for (set<list<NodeTraversal> >::iterator n = next_paths.begin(); n != next_paths.end(); ++n) {
-            list<NodeTraversal> path = *p;
-
-            // Find the iterator to this node in the list that will become the
-            // path. We know it's the last thing in the prev kpath we made our path from.
-            list<NodeTraversal>::iterator this_node = path.end(); this_node--;
-
-            list<NodeTraversal>::const_iterator m = n->begin(); ++m; // skips current node, which is included in *p in the correct orientation
-            while (m != n->end()) {
-                // Add on all the other nodes from the next kpath.
-                path.push_back(*m);
-                ++m;
-            }
+    // get left, then right, each stored end to end in one buffer along with
+    // where each path ends
+    vector<NodeTraversal> stack;
+    vector<NodeTraversal> prev_nodes;
+    vector<size_t> prev_ends;
+    vector<NodeTraversal> next_nodes;
+    vector<size_t> next_ends;
+    bool edge_bounding = (edge_max != 0);
+
+    kpath_extensions(NodeTraversal(node), k, edge_max, edge_bounding, true, prev_maxed, stack,
+                     [&prev_nodes, &prev_ends](vector<NodeTraversal>& prev) {
+                         // the stack runs leftward from the node, so store it reversed
+                         prev_nodes.insert(prev_nodes.end(), prev.rbegin(), prev.rend());
+                         prev_ends.push_back(prev_nodes.size());
+                     });
+    kpath_extensions(NodeTraversal(node), k, edge_max, edge_bounding, false, next_maxed, stack,
+                     [&next_nodes, &next_ends](vector<NodeTraversal>& next) {
+                         next_nodes.insert(next_nodes.end(), next.begin(), next.end());
+                         next_ends.push_back(next_nodes.size());
+                     });
+
+    // now take the cross and give to the callback, reusing the same list
+    // (and its nodes) for every path we hand out
+    vector<NodeTraversal> joined;
+    list<NodeTraversal> path;
+    size_t prev_begin = 0;
+    for (size_t prev_end : prev_ends) {
+        size_t next_begin = 0;
+        for (size_t next_end : next_ends) {
+            joined.assign(prev_nodes.begin() + prev_begin, prev_nodes.begin() + prev_end);
+            // skip the current node, which is included in the prev kpath in the correct orientation
+            joined.insert(joined.end(), next_nodes.begin() + next_begin + 1, next_nodes.begin() + next_end);
+            path.assign(joined.begin(), joined.end());
+
+            // This node is the last thing in the prev kpath we made our path from.
+            list<NodeTraversal>::iterator this_node = path.begin();
+            advance(this_node, prev_end - prev_begin - 1);
 
             lambda(this_node, path);
+            next_begin = next_end;
         }
+        prev_begin = prev_end;
     }
 }
 
@@ -2819,6 +3092,246 @@ void VG::edit(const map<int64_t, vector<Mapping> >& mappings,
     remove_null_nodes_forwarding_edges();
 }
 
+void VG::vcf_to_alleles(vcflib::VariantCallFile& variantCallFile,
+                        map<string, map<long, set<vcflib::VariantAllele> > >& alleles) {
+    vcflib::Variant var(variantCallFile);
+    while (variantCallFile.getNextVariant(var)) {
+        bool isDNA = allATGC(var.ref);
+        for (vector<string>::iterator a = var.alt.begin(); a != var.alt.end(); ++a) {
+            if (!allATGC(*a)) isDNA = false;
+        }
+        // only work with DNA sequences
+        if (!isDNA) continue;
+        var.position -= 1; // convert to 0-based
+        auto& seq_alleles = alleles[var.sequenceName];
+        for (auto& alts : var.parsedAlternates()) {
+            for (auto& allele : alts.second) {
+                seq_alleles[allele.position].insert(allele);
+            }
+        }
+    }
+}
+
+long VG::reference_positions(const string& path_name, map<long, int64_t>& positions) {
+    if (!paths.has_path(path_name)) {
+        cerr << "[vg] error: no path named " << path_name << " to place variants against" << endl;
+        exit(1);
+    }
+    list<Mapping>& path = paths.get_path(path_name);
+    long pos = 0;
+    for (auto m = path.begin(); m != path.end(); ++m) {
+        bool simple = !m->is_reverse() && m->position().offset() == 0;
+        for (int i = 0; i < m->edit_size(); ++i) {
+            if (!edit_is_match(m->edit(i))) simple = false;
+        }
+        if (!simple) {
+            cerr << "[vg] error: path " << path_name << " is not a forward reference path without edits at node "
+                 << m->position().node_id() << endl;
+            exit(1);
+        }
+        Node* node = get_node(m->position().node_id());
+        if (!node->sequence().empty()) {
+            positions[pos] = node->id();
+            pos += node->sequence().size();
+        } else if (m == path.begin()) {
+            positions[-1] = node->id();
+        } else if (&*m == &path.back()) {
+            positions[pos] = node->id();
+        }
+    }
+    return pos;
+}
+
+void VG::nodes_at_alleles(const map<string, map<long, set<vcflib::VariantAllele> > >& alleles,
+                          set<int64_t>& ids) {
+    for (auto& seq_alleles : alleles) {
+        map<long, int64_t> ref;
+        long length = reference_positions(seq_alleles.first, ref);
+        for (auto& va : seq_alleles.second) {
+            for (auto& allele : va.second) {
+                if (allele.ref == allele.alt) continue;
+                long start = allele.position;
+                long end = start + allele.ref.size();
+                // the nodes holding the bases on either side of the allele and
+                // any it replaces, which are the ones we would cut or attach to
+                auto n = ref.upper_bound(max(start - 1, (long) 0));
+                if (n != ref.begin()) --n;
+                if (start == 0 && ref.count(-1)) ids.insert(ref[-1]);
+                for ( ; n != ref.end() && n->first <= min(end, length - 1); ++n) {
+                    ids.insert(n->second);
+                }
+                if (end == length && ref.count(length)) ids.insert(ref[length]);
+            }
+        }
+    }
+}
+
+void VG::add_alleles(const map<string, map<long, set<vcflib::VariantAllele> > >& alleles,
+                     set<int64_t>& removed,
+                     set<int64_t>& added,
+                     set<int64_t>& updated) {
+
+    // nodes that get new edges but are not themselves replaced
+    set<int64_t> attached;
+
+    for (auto& seq_alleles : alleles) {
+        const string& name = seq_alleles.first;
+        map<long, int64_t> ref;
+        long length = reference_positions(name, ref);
+
+        // make sure there is a node boundary on the reference path at pos
+        auto cut = [&](long pos) {
+            if (pos <= 0 || pos >= length) return;
+            auto n = ref.upper_bound(pos); --n;
+            if (n->first == pos) return;
+            int64_t old_id = n->second;
+            Node* l = NULL; Node* r = NULL;
+            divide_node(get_node(old_id), pos - n->first, l, r);
+            // nodes we made and then divided again never existed as far as
+            // the caller is concerned
+            if (!added.erase(old_id)) removed.insert(old_id);
+            attached.erase(old_id);
+            added.insert(l->id());
+            added.insert(r->id());
+            n->second = l->id();
+            ref[pos] = r->id();
+        };
+
+        for (auto& va : seq_alleles.second) {
+            for (auto& allele : va.second) {
+
+                // skip ref-matching alleles; these are not informative
+                if (allele.ref == allele.alt) {
+                    continue;
+                }
+
+                long start = allele.position;
+                long end = start + allele.ref.size();
+                if (start < 0 || end > length) {
+                    cerr << "[vg] error: allele " << allele << " falls outside path " << name << endl;
+                    exit(1);
+                }
+
+                // as from_alleles does, give variation at the ends of the
+                // reference something to hang from
+                if (start == 0 && !ref.count(-1)) {
+                    Node* root = create_node("");
+                    create_edge(root, get_node(ref.begin()->second));
+                    list<Mapping>& path = paths.get_path(name);
+                    Mapping m;
+                    m.mutable_position()->set_node_id(root->id());
+                    paths.insert_mapping(path.begin(), name, m);
+                    ref[-1] = root->id();
+                    added.insert(root->id());
+                }
+                if (end == length && !ref.count(length)) {
+                    Node* last = get_node(ref.rbegin()->second);
+                    Node* tail = create_node("");
+                    create_edge(last, tail);
+                    paths.append_mapping(name, tail->id());
+                    ref[length] = tail->id();
+                    added.insert(tail->id());
+                }
+
+                cut(start);
+                cut(end);
+
+                // the reference nodes that start at the allele start and end
+                auto s = ref.find(start);
+                auto e = ref.find(end);
+                // and those that end at the allele start and end
+                int64_t before_start = prev(s)->second;
+                int64_t before_end = prev(e)->second;
+
+                // the sides attached to the left of the allele, and to its right
+                vector<pair<int64_t, bool>> ins = edges_start(s->second);
+                vector<pair<int64_t, bool>> outs = edges_end(before_end);
+
+                if (!allele.alt.empty()) {
+                    // check if we already have this allele
+                    bool present = false;
+                    for (auto& o : edges_end(before_start)) {
+                        Node* n = get_node(o.first);
+                        if (!o.second && n->sequence() == allele.alt
+                            && has_edge(NodeSide(n->id(), true), NodeSide(e->second, false))) {
+                            present = true;
+                        }
+                    }
+                    if (present) continue;
+                    Node* alt_node = create_node(allele.alt);
+                    added.insert(alt_node->id());
+                    for (auto& i : ins) {
+                        create_edge(i.first, alt_node->id(), i.second, false);
+                        attached.insert(i.first);
+                    }
+                    for (auto& o : outs) {
+                        create_edge(alt_node->id(), o.first, false, o.second);
+                        attached.insert(o.first);
+                    }
+                } else {
+                    // a deletion joins everything before it to everything after
+                    if (has_edge(NodeSide(before_start, true), NodeSide(e->second, false))) {
+                        continue;
+                    }
+                    for (auto& i : ins) {
+                        for (auto& o : outs) {
+                            create_edge(i.first, o.first, i.second, o.second);
+                            attached.insert(i.first);
+                            attached.insert(o.first);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // dividing nodes also changes the edges of their neighbors
+    for (auto id : added) {
+        if (!has_node(id)) continue;
+        for (auto& o : edges_start(id)) attached.insert(o.first);
+        for (auto& o : edges_end(id)) attached.insert(o.first);
+    }
+    for (auto id : attached) {
+        if (!added.count(id) && has_node(id)) {
+            updated.insert(id);
+        }
+    }
+}
+
+void VG::nodes_near(const set<int64_t>& ids, int length, set<int64_t>& near) {
+    // the fewest bp seen between each node and the given ones
+    hash_map<int64_t, int> dist;
+    // nodes waiting to be expanded, nearest first
+    set<pair<int, int64_t> > todo;
+    for (auto id : ids) {
+        if (!has_node(id)) continue;
+        dist[id] = 0;
+        todo.insert(make_pair(0, id));
+    }
+    while (!todo.empty()) {
+        int d = todo.begin()->first;
+        int64_t id = todo.begin()->second;
+        todo.erase(todo.begin());
+        near.insert(id);
+        // the given nodes are where we measure from, so they add no distance
+        int next_d = ids.count(id) ? 0 : d + get_node(id)->sequence().size();
+        if (next_d >= length) continue;
+        auto visit = [&](vector<pair<int64_t, bool>>& sides) {
+            for (auto& o : sides) {
+                if (!has_node(o.first)) continue;
+                auto f = dist.find(o.first);
+                if (f == dist.end() || f->second > next_d) {
+                    if (f != dist.end()) todo.erase(make_pair(f->second, o.first));
+                    dist[o.first] = next_d;
+                    todo.insert(make_pair(next_d, o.first));
+                }
+            }
+        };
+        visit(edges_start(id));
+        visit(edges_end(id));
+    }
+}
+
 void VG::node_starts_in_path(const list<NodeTraversal>& path,
                              map<Node*, int>& node_start) {
     int i = 0;
@@ -3158,7 +3671,12 @@ void VG::to_gfa(ostream& out) {
         Node* n = graph.mutable_node(i);
         stringstream s;
         s << "S" << "\t" << n->id() << "\t" << n->sequence() << "\n";
-        auto& node_mapping = paths.get_node_mapping(n->id());
+        // the index keeps no order, so sort for stable output
+        auto node_mapping = paths.get_node_mapping(n->id());
+        std::sort(node_mapping.begin(), node_mapping.end(),
+             [this](const pair<int64_t, Mapping*>& a, const pair<int64_t, Mapping*>& b) {
+                 return paths.node_mapping_before(a, b);
+             });
         set<Mapping*> seen;
         for (auto& p : node_mapping) {
             if (seen.count(p.second)) continue;
@@ -3176,7 +3694,7 @@ void VG::to_gfa(ostream& out) {
                 cigar = cigarss.str();
             }
             string orientation = mapping.is_reverse() ? "-" : "+";
-            s << "P" << "\t" << n->id() << "\t" << p.first << "\t"
+            s << "P" << "\t" << n->id() << "\t" << paths.get_path_name(p.first) << "\t"
               << orientation << "\t" << cigar << "\n";
         }
         sorted_output[n->id()].push_back(s.str());
@@ -3198,12 +3716,6 @@ void VG::to_gfa(ostream& out) {
     }
 }
 
-void VG::destroy_alignable_graph(void) {
-    if (gssw_aligner != NULL) {
-        delete gssw_aligner;
-    }
-}
-
 void VG::connect_node_to_nodes(Node* node, vector<Node*>& nodes, bool from_start) {
     for (vector<Node*>::iterator n = nodes.begin(); n != nodes.end(); ++n) {
         // Connect them left to right, unless instructed otherwise
@@ -3377,20 +3889,80 @@ void VG::add_single_start_end_marker(int length, char start_char, Node*& head_ta
 
 Alignment& VG::align(Alignment& alignment) {
 
+    // Orient and order the nodes as orient_nodes_forward would, but keep the
+    // flipped sequences to ourselves so we don't have to touch the graph.
+    deque<NodeTraversal> order_and_orientation;
+    topological_sort(order_and_orientation);
+    vector<pair<NodeSide, NodeSide>> oriented_edges;
+    vector<int64_t> kept;
+    orient_edges_forward(order_and_orientation, oriented_edges, kept);
+
     set<int64_t> flipped_nodes;
-    orient_nodes_forward(flipped_nodes);
+    hash_map<int64_t, Node*> oriented_nodes;
+    deque<Node> flipped_copies;
+    for (auto& traversal : order_and_orientation) {
+        Node* node = traversal.node;
+        if (traversal.backward) {
+            flipped_nodes.insert(node->id());
+            flipped_copies.emplace_back();
+            flipped_copies.back().set_id(node->id());
+            flipped_copies.back().set_sequence(reverse_complement(node->sequence()));
+            node = &flipped_copies.back();
+        }
+        oriented_nodes[node->id()] = node;
+    }
 
-    // to be completely aligned, the graph's head nodes need to be fully-connected to a common root
-    Node* root = join_heads();
-    // Put the nodes in sort order within the graph
-    sort();
+    // Every kept edge now runs from the end of one node to the start of the
+    // next. Count how many come into each node.
+    hash_map<int64_t, vector<int64_t>> next;
+    hash_map<int64_t, int64_t> in_degree;
+    for (auto& entry : oriented_nodes) {
+        in_degree[entry.first] = 0;
+    }
+    for (int64_t i : kept) {
+        next[oriented_edges[i].first.node].push_back(oriented_edges[i].second.node);
+        ++in_degree[oriented_edges[i].second.node];
+    }
 
-    gssw_aligner = new GSSWAligner(graph);
-    gssw_aligner->align(alignment);
-    delete gssw_aligner;
-    gssw_aligner = NULL;
+    // to be completely aligned, the graph's head nodes need to be
+    // fully-connected to a common root
+    Node root;
+    root.set_id(max_node_id() + 1);
+    root.set_sequence("N");
+    vector<pair<int64_t, int64_t>> alignable_edges;
+    for (int64_t i : kept) {
+        alignable_edges.push_back(make_pair(oriented_edges[i].first.node, oriented_edges[i].second.node));
+    }
 
-    destroy_node(root);
+    // Put the nodes in the order sort() would: the root, and then the lowest
+    // id whose incoming edges are all used up each time.
+    vector<Node*> sorted_nodes;
+    sorted_nodes.reserve(oriented_nodes.size() + 1);
+    sorted_nodes.push_back(&root);
+    priority_queue<int64_t, vector<int64_t>, greater<int64_t>> ready;
+    for (int i = 0; i < graph.node_size(); ++i) {
+        int64_t id = graph.node(i).id();
+        if (in_degree[id] == 0) {
+            alignable_edges.push_back(make_pair(root.id(), id));
+            ready.push(id);
+        }
+    }
+    while (!ready.empty()) {
+        int64_t id = ready.top();
+        ready.pop();
+        sorted_nodes.push_back(oriented_nodes[id]);
+        auto found = next.find(id);
+        if (found != next.end()) {
+            for (int64_t to : found->second) {
+                if (--in_degree[to] == 0) {
+                    ready.push(to);
+                }
+            }
+        }
+    }
+
+    GSSWAligner aligner(sorted_nodes, alignable_edges);
+    aligner.align(alignment);
 
     flip_nodes(alignment, flipped_nodes, [this](int64_t node_id) {
             // We need to feed in the lengths of nodes, so the offsets in the alignment can be updated.
@@ -3434,6 +4006,62 @@ void VG::for_each_kmer_of_node(Node* node,
     _for_each_kmer(kmer_size, edge_max, lambda, false, stride, allow_dups, allow_negatives, node);
 }
 
+// Identifies a kmer seen from the node whose kmers are being enumerated, for
+// removing duplicates that arise from different kpaths of the node. The kmer
+// is held as its 2-bit code when that is exact, and as a string otherwise.
+struct KmerInstance {
+    uint64_t code;
+    string seq;
+    int64_t start_node;
+    int32_t start_offset;
+    int32_t view_offset;
+    int64_t end_node;
+    int32_t end_offset;
+    bool operator==(const KmerInstance& other) const {
+        return code == other.code && start_node == other.start_node
+            && start_offset == other.start_offset && view_offset == other.view_offset
+            && end_node == other.end_node && end_offset == other.end_offset
+            && seq == other.seq;
+    }
+};
+
+struct KmerInstanceHash {
+    // 64-bit finalizer from murmur3
+    static uint64_t mix(uint64_t h) {
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
+    }
+    size_t operator()(const KmerInstance& k) const {
+        uint64_t h = mix(k.code);
+        h = mix(h ^ (uint64_t) k.start_node);
+        h = mix(h ^ ((uint64_t) (uint32_t) k.start_offset << 32 | (uint32_t) k.view_offset));
+        h = mix(h ^ (uint64_t) k.end_node);
+        h = mix(h ^ (uint32_t) k.end_offset);
+        if (!k.seq.empty()) {
+            h ^= std::hash<string>()(k.seq);
+        }
+        return h;
+    }
+};
+
+// Scratch space for enumerating the kmers of one node at a time, reused from
+// node to node so the inner loop doesn't allocate.
+struct KmerScratch {
+    // the node instances along the current kpath and where each starts in its sequence
+    vector<list<NodeTraversal>::iterator> instances;
+    vector<int> starts;
+    string seq;
+    string kmer;
+    string reversed_kmer;
+    // the kmers already passed on for the current node
+    unordered_set<KmerInstance, KmerInstanceHash> seen;
+    KmerInstance key;
+};
+
 void VG::_for_each_kmer(int kmer_size,
                         int edge_max,
                         function<void(string&, list<NodeTraversal>::iterator, int, list<NodeTraversal>&, VG&)> lambda,
@@ -3443,34 +4071,22 @@ void VG::_for_each_kmer(int kmer_size,
                         bool allow_negatives,
                         Node* node) {
 
-    // use an LRU cache to clean up duplicates over the last 1mb
-    // use one per thread so as to avoid contention
-    // If we aren't starting a parallel kmer iteration from here, just fill in 0.
-    // TODO: How do we know this is big enough?
-    map<int, LRUCache<string, bool>* > lru;
-#pragma omp parallel
-    {
-#pragma omp single
-        for (int i = 0; i < (parallel ? omp_get_num_threads() : 1); ++i) {
-            lru[i] = new LRUCache<string, bool>(100000);
-        }
-    }
-    // constructs the cache key
-    // experiment -- use a struct here
-    // We deduplicate kmers based on where they start, where they end (optionally), and where they are viewed from.
-    auto make_cache_key = [](string& kmer,
-                             int64_t start_node, int start_pos,
-                             int64_t view_node, int view_pos,
-                             int64_t end_node, int end_pos) -> string {
-        string cache_key = kmer;
-        cache_key.resize(kmer.size() + sizeof(Node*) + 3*sizeof(int64_t) + 3*sizeof(int));
-        memcpy((char*)cache_key.c_str()+kmer.size(), &start_node, sizeof(int64_t));
-        memcpy((char*)cache_key.c_str()+kmer.size()+1*sizeof(int64_t), &start_pos, sizeof(int));
-        memcpy((char*)cache_key.c_str()+kmer.size()+1*sizeof(int64_t)+1*sizeof(int), &view_node, sizeof(int64_t));
-        memcpy((char*)cache_key.c_str()+kmer.size()+2*sizeof(int64_t)+1*sizeof(int), &view_pos, sizeof(int));
-        memcpy((char*)cache_key.c_str()+kmer.size()+2*sizeof(int64_t)+2*sizeof(int), &end_node, sizeof(int64_t));
-        memcpy((char*)cache_key.c_str()+kmer.size()+3*sizeof(int64_t)+2*sizeof(int), &end_pos, sizeof(int));
-        return cache_key;
+    // One scratch space per thread if we launch threads from here, and just
+    // one otherwise. Remember that _for_each_kmer itself may be called by
+    // many threads in parallel, so this can't be shared between calls.
+    vector<KmerScratch> scratch(parallel ? omp_get_max_threads() : 1);
+
+    // kmers of up to 32bp fit exactly in a 2-bit code
+    bool exact_code = kmer_size <= 32;
+    uint64_t code_mask = kmer_size >= 32 ? ~(uint64_t) 0 : ((uint64_t) 1 << (2 * kmer_size)) - 1;
+    auto encode = [](char c) -> int {
+        switch (c) {
+        case 'A': case 'a': return 0;
+        case 'C': case 'c': return 1;
+        case 'G': case 'g': return 2;
+        case 'T': case 't': return 3;
+        default: return -1;
+        }
     };
 
     auto handle_path = [this,
@@ -3479,10 +4095,12 @@ void VG::_for_each_kmer(int kmer_size,
                         stride,
                         allow_dups,
                         allow_negatives,
-                        &lru,
-                        &make_cache_key,
-                        &parallel,
-                        &node](list<NodeTraversal>::iterator forward_node, list<NodeTraversal>& forward_path) {
+                        exact_code,
+                        code_mask,
+                        &encode,
+                        &node](KmerScratch& s,
+                               list<NodeTraversal>::iterator forward_node,
+                               list<NodeTraversal>& forward_path) {
 #ifdef debug
         cerr << "Handling path: " << endl;
         for(auto& traversal : forward_path) {
@@ -3496,250 +4114,243 @@ void VG::_for_each_kmer(int kmer_size,
         // And one for the reversed version of this NodeTraversal on that path
         list<NodeTraversal>::iterator reversed_node;
 
-
-        // expand the path into a vector :: 1,1,1,2,2,2,2,3,3 ... etc.
-        // this makes it much easier to quickly get all the node matches of each kmer
-
-        // We expand out as iterators in the path list, so we can get the
-        // traversal but also distinguish different node instances in the path.
-        vector<list<NodeTraversal>::iterator> node_by_path_position;
-        expand_path(forward_path, node_by_path_position);
-
-        // Go get the cache for this thread if _for_each_kmer launched threads,
-        // and the only one we made (thread 0) if we're running this
-        // _for_each_kmer call in a single thread. Remember that _for_each_kmer
-        // itself may be called by many MPI threads in parallel.
-        auto cache = lru[parallel ? omp_get_thread_num() : 0];
-        assert(cache != nullptr);
-
-        map<NodeTraversal*, int> node_start;
-        node_starts_in_path(forward_path, node_start);
-
-        // now process the kmers of this sequence
-        // by first getting the sequence
-        string seq = path_string(forward_path);
+        // lay out the node instances of the path and its sequence
+        s.instances.clear();
+        s.starts.clear();
+        s.seq.clear();
+        // the index of the instance we're interested in the kmers of
+        int forward_index = -1;
+        for (list<NodeTraversal>::iterator n = forward_path.begin(); n != forward_path.end(); ++n) {
+            if (n == forward_node) forward_index = s.instances.size();
+            s.instances.push_back(n);
+            s.starts.push_back(s.seq.size());
+            const string& node_seq = (*n).node->sequence();
+            if ((*n).backward) {
+                for (auto c = node_seq.rbegin(); c != node_seq.rend(); ++c) {
+                    s.seq.push_back(reverse_complement(*c));
+                }
+            } else {
+                s.seq.append(node_seq);
+            }
+        }
+        s.starts.push_back(s.seq.size());
+        assert(forward_index >= 0);
 
         // but bail out if the sequence is shorter than the kmer size
-        if (seq.size() < kmer_size) return;
-
-        // and then stepping across the path, finding the kmers, and then implied node overlaps
-        for (int i = 0; i <= seq.size() - kmer_size; i+=stride) {
-
-            // get the kmer
-            string forward_kmer = seq.substr(i, kmer_size);
-            // record when we get a kmer match
-
-            // We'll fill this in if needed.
-            string reversed_kmer;
-
-            // execute our callback on each kmer/node/position
-            // where node == node
-            int j = 0;
-            while (j < kmer_size) {
-                if (forward_node == node_by_path_position[i+j]) {
-                    // At this position along this possible kmer, we're in the
-                    // instance of the node we're interested in the kmers of.
-
-
-                    // Grab the node the kmer started at
-                    list<NodeTraversal>::iterator start_node = node_by_path_position[i];
-                    // And the one it's going to end at
-                    list<NodeTraversal>::iterator end_node = node_by_path_position[i + kmer_size - 1];
-                    // Work out how far into its actual starting node this kmer started.
-                    size_t start_node_offset = i - node_start[&(*start_node)];
-
-                    if(!allow_negatives && node == nullptr) {
-                        // If we do allow negatives, we'll just articulate kmers
-                        // from both sides whenever they cross edges. Otherwise,
-                        // we only want edge-crossing kmers once, so we should
-                        // only announce them to the callback from one of their
-                        // ends. We arbitrarily choose the end with the lower
-                        // node ID.
-
-                        // We only do this when we aren't getting the kmers of a
-                        // specific node.
-
-                        if(forward_node == start_node &&
-                           (*start_node).node->id() > (*end_node).node->id()) {
-                            // We're on the start, but it's ID is larger than the end's.
-                            // Announce the kmer from the end instead.
-                            ++j;
-                            continue;
-                        }
-
-                        if(forward_node == end_node &&
-                           (*end_node).node->id() > (*start_node).node->id()) {
-                            // We're on the end, but it's ID is larger than the start's.
-                            // Announce the kmer from the start instead.
-                            ++j;
-                            continue;
-                        }
-
-                        if((*end_node).node->id() == (*start_node).node->id() &&
-                            end_node != start_node &&
-                            forward_node == end_node) {
+        int seq_size = s.seq.size();
+        if (seq_size < kmer_size) return;
+
+        // only the kmers overlapping our node instance concern us
+        int node_position = s.starts[forward_index];
+        int node_end = s.starts[forward_index + 1];
+        int first = max(0, node_position - kmer_size + 1);
+        // stay on the stride as counted from the start of the path
+        first = (first + stride - 1) / stride * stride;
+        int last = min(node_end - 1, seq_size - kmer_size);
+        if (first > last) return;
+
+        // roll the 2-bit code of the kmer up to the first one
+        uint64_t code = 0;
+        // the last position holding something we can't encode
+        int last_bad = first - 1;
+        int coded_to = first;
+        auto roll_to = [&](int end) {
+            for ( ; coded_to < end; ++coded_to) {
+                int b = encode(s.seq[coded_to]);
+                if (b < 0) {
+                    last_bad = coded_to;
+                    b = 0;
+                }
+                code = ((code << 2) | b) & code_mask;
+            }
+        };
 
-                            // If this kmer starts and ends in different
-                            // instances of the same node along the path, only
-                            // announce it from the one it starts in. Skip the
-                            // one it ends in.
-                            ++j;
-                            continue;
-                        }
-                    }
+        // the instances holding the first and last bases of the kmer
+        int start_index = 0;
+        int end_index = 0;
+
+        for (int i = first; i <= last; i += stride) {
+
+            roll_to(i + kmer_size);
+            while (s.starts[start_index + 1] <= i) ++start_index;
+            while (s.starts[end_index + 1] <= i + kmer_size - 1) ++end_index;
+
+            list<NodeTraversal>::iterator start_node = s.instances[start_index];
+            list<NodeTraversal>::iterator end_node = s.instances[end_index];
+            // Work out how far into its actual starting node this kmer started.
+            int start_node_offset = i - s.starts[start_index];
+
+            if(!allow_negatives && node == nullptr) {
+                // If we do allow negatives, we'll just articulate kmers
+                // from both sides whenever they cross edges. Otherwise,
+                // we only want edge-crossing kmers once, so we should
+                // only announce them to the callback from one of their
+                // ends. We arbitrarily choose the end with the lower
+                // node ID.
+
+                // We only do this when we aren't getting the kmers of a
+                // specific node.
+
+                if(forward_node == start_node &&
+                   (*start_node).node->id() > (*end_node).node->id()) {
+                    // We're on the start, but it's ID is larger than the end's.
+                    // Announce the kmer from the end instead.
+                    continue;
+                }
 
-                    // We now know we should announce this kmer from this node.
-
-                    // Work out where this node started along the path
-                    int node_position = node_start[&(*forward_node)];
-                    // And how far into the node this kmer started
-                    int kmer_forward_relative_start = i - node_position;
-                    // Negative-offset kmers will be processed, but will be
-                    // corrected to the opposite strand if negative offsets are
-                    // not allowed.
-                    int kmer_reversed_relative_start;
-                    // Did we flip?
-                    bool reversed = false;
-                    if(kmer_forward_relative_start < 0 && !allow_negatives) {
-                        // This kmer starts at a negative offset from this node.
-                        // We need to announce it with a positive offset.
-
-                        size_t node_length = (*forward_node).node->sequence().size();
-
-                        if(kmer_forward_relative_start + kmer_size > node_length) {
-                            // If it doesn't start or end in this node, and is
-                            // just passing through, there's no way to
-                            // articulate it for this node with a positive
-                            // offset, so we just skip to the next character in
-                            // the kmer.
-                            ++j;
-                            continue;
-                        }
+                if(forward_node == end_node &&
+                   (*end_node).node->id() > (*start_node).node->id()) {
+                    // We're on the end, but it's ID is larger than the start's.
+                    // Announce the kmer from the start instead.
+                    continue;
+                }
 
-                        // We know the kmer has its end in this node.
+                if((*end_node).node->id() == (*start_node).node->id() &&
+                    end_node != start_node &&
+                    forward_node == end_node) {
 
-                        // If it ends in this node, we can reverse it and get a
-                        // positive offset.
+                    // If this kmer starts and ends in different
+                    // instances of the same node along the path, only
+                    // announce it from the one it starts in. Skip the
+                    // one it ends in.
+                    continue;
+                }
+            }
 
-                        if(reversed_kmer.empty()) {
-                            // Fill in the reversed kmer the first time we need it.
-                            reversed_kmer = reverse_complement(forward_kmer);
-                        }
+            // We now know we should announce this kmer from this node.
+
+            // How far into the node this kmer started
+            int kmer_forward_relative_start = i - node_position;
+            // Negative-offset kmers will be processed, but will be
+            // corrected to the opposite strand if negative offsets are
+            // not allowed.
+            int kmer_reversed_relative_start = 0;
+            // Did we flip?
+            bool reversed = false;
+            if(kmer_forward_relative_start < 0 && !allow_negatives) {
+                // This kmer starts at a negative offset from this node.
+                // We need to announce it with a positive offset.
+
+                size_t node_length = (*forward_node).node->sequence().size();
+
+                if(kmer_forward_relative_start + kmer_size > node_length) {
+                    // If it doesn't start or end in this node, and is
+                    // just passing through, there's no way to
+                    // articulate it for this node with a positive
+                    // offset, so we skip it.
+                    continue;
+                }
 
-                        if(reversed_path.empty()) {
-                            // Only fill in the reversed path the first time we need it.
-                            for(NodeTraversal traversal : forward_path) {
-                                // Operate on copies here
-                                traversal.backward = !traversal.backward;
-                                reversed_path.push_front(traversal);
-                            }
-
-                            // Fill in the reversed iterator too
-                            reversed_node = reversed_path.begin();
-                            list<NodeTraversal>::iterator i(forward_node);
-
-                            // If forward_node is the last non-end() item, we
-                            // don't want to advance reversed_node at all from
-                            // the first item of the reversed path.
-                            ++i;
-
-                            while(i != forward_path.end()) {
-                                // Walk i towards the end of the forward path,
-                                // and reversed_node in from the corresponding
-                                // end of the reversed path.
-                                ++i;
-                                ++reversed_node;
-                            }
-                        }
+                // We know the kmer has its end in this node.
 
-                        // Flip the kmer start around to something that will be positive.
-                        // We don't need a -1 here.
-                        kmer_reversed_relative_start = node_length - (kmer_forward_relative_start + kmer_size);
+                // If it ends in this node, we can reverse it and get a
+                // positive offset.
 
-                        // We flipped.
-                        reversed = true;
+                if(reversed_path.empty()) {
+                    // Only fill in the reversed path the first time we need it.
+                    for(NodeTraversal traversal : forward_path) {
+                        // Operate on copies here
+                        traversal.backward = !traversal.backward;
+                        reversed_path.push_front(traversal);
                     }
 
-                    // Set up some references so we don't need to make local
-                    // copies unless we actually did need to reverse the kmer.
-                    string& kmer = reversed ? reversed_kmer : forward_kmer;
-                    list<NodeTraversal>::iterator& instance = reversed ? reversed_node : forward_node;
-                    list<NodeTraversal>& path = reversed ? reversed_path : forward_path;
-                    int& kmer_relative_start = reversed ? kmer_reversed_relative_start : kmer_forward_relative_start;
-
-                    // Make sure we aren't disobeying instructions
-                    assert(!(kmer_relative_start < 0 && !allow_negatives));
-
-                    // What key in the cache do we say that we processed? We're
-                    // going to cache kmers in their forward orientation, even
-                    // if they are at negative relative offsets and we aren't
-                    // supposed to be using those. Because for_each_kpath only
-                    // ever presents a node to this function in its forward
-                    // orientation, we'll never have a situation where we should
-                    // have done the cache key on the opposite strand.
-                    string cache_key;
-                    if (allow_dups) {
-                        // Duplicate kmers starting at the same place are allowed if the paths go to different places next.
-                        // This is deduplicating by node ID so we don't have to worry about instances on the path.
-                        // TODO: forward_node won't be passed in as a backward traversal from for_each_kpath, right?
-
-                        // figure out past-the-end-of-the-kmer position and node
-                        list<NodeTraversal>::iterator past_end = (i+kmer_size >= node_by_path_position.size())
-                            ? path.end()
-                            : node_by_path_position[i + kmer_size-1];
-                        int node_past_end_position = (past_end == path.end()) ? 0 : i+kmer_size - node_start[&(*past_end)];
+                    // The instance sits as far from the start of the
+                    // reversed path as it does from the end of the forward one.
+                    reversed_node = reversed_path.begin();
+                    std::advance(reversed_node, s.instances.size() - 1 - forward_index);
+                }
 
-#ifdef debug
-                        cerr << "Checking for duplicates of " << (*start_node).node->id() << "." << start_node_offset
-                             << "-" << forward_kmer  << "-" << (past_end == path.end() ? 0 : (*past_end).node->id()) << "."
-                             << node_past_end_position << " viewed from "
-                             << (*forward_node).node->id() << " offset " << kmer_forward_relative_start << endl;
-#endif
+                // Flip the kmer start around to something that will be positive.
+                // We don't need a -1 here.
+                kmer_reversed_relative_start = node_length - (kmer_forward_relative_start + kmer_size);
 
-                        cache_key = make_cache_key(forward_kmer, (*start_node).node->id(), start_node_offset,
-                                                                 (*forward_node).node->id(), kmer_forward_relative_start,
-                                                                 (past_end == path.end() ? 0 : (*past_end).node->id()),
-                                                                 node_past_end_position);
-                    } else {
-                        // Duplicate kmers starting at the same place aren't allowed, no matter where they go after the end.
-                        // This is deduplicating by node ID so we don't have to worry about instances on the path.
-                        cache_key = make_cache_key(forward_kmer, (*start_node).node->id(), start_node_offset,
-                                                                 (*forward_node).node->id(), kmer_forward_relative_start,
-                                                                 0, 0);
-                    }
+                // We flipped.
+                reversed = true;
+            }
 
-                    // See if this kmer is mentioned in the cache already
-                    pair<bool, bool> c = cache->retrieve(cache_key);
-                    if (!c.second && (*instance).node != NULL) {
-                        // TODO: how could we ever get a null node here?
-                        // If not, put it in and run on it.
-                        cache->put(cache_key, true);
+            // What do we say that we processed? We're going to key kmers
+            // in their forward orientation, even if they are at negative
+            // relative offsets and we aren't supposed to be using those.
+            // Because for_each_kpath only ever presents a node to this
+            // function in its forward orientation, we'll never have a
+            // situation where we should have keyed on the opposite strand.
+            // The node we view the kmer from is implied, as we only keep
+            // keys for one node at a time.
+            KmerInstance& key = s.key;
+            key.start_node = (*start_node).node->id();
+            key.start_offset = start_node_offset;
+            key.view_offset = kmer_forward_relative_start;
+            key.code = code;
+            key.seq.clear();
+            if (!exact_code || last_bad >= i) {
+                key.seq.assign(s.seq, i, kmer_size);
+            }
+            if (allow_dups && i + kmer_size < seq_size) {
+                // Duplicate kmers starting at the same place are allowed if
+                // the paths go to different places next.
+                key.end_node = (*end_node).node->id();
+                key.end_offset = i + kmer_size - s.starts[end_index];
+            } else {
+                // Duplicate kmers starting at the same place aren't allowed,
+                // no matter where they go after the end.
+                key.end_node = 0;
+                key.end_offset = 0;
+            }
 
-                        lambda(kmer, instance, kmer_relative_start, path, *this);
-                    } else {
+            if (!s.seen.insert(key).second) {
 #ifdef debug
-                        cerr << "Skipped " << kmer << " because it was already done" << endl;
+                cerr << "Skipped " << s.seq.substr(i, kmer_size) << " because it was already done" << endl;
 #endif
-                    }
+                continue;
+            }
 
+            // get the kmer
+            s.kmer.assign(s.seq, i, kmer_size);
+            if (reversed) {
+                s.reversed_kmer.clear();
+                for (auto c = s.kmer.rbegin(); c != s.kmer.rend(); ++c) {
+                    s.reversed_kmer.push_back(reverse_complement(*c));
                 }
-                ++j;
             }
+
+            // Set up some references so we don't need to make local
+            // copies unless we actually did need to reverse the kmer.
+            string& kmer = reversed ? s.reversed_kmer : s.kmer;
+            list<NodeTraversal>::iterator& instance = reversed ? reversed_node : forward_node;
+            list<NodeTraversal>& path = reversed ? reversed_path : forward_path;
+            int& kmer_relative_start = reversed ? kmer_reversed_relative_start : kmer_forward_relative_start;
+
+            // Make sure we aren't disobeying instructions
+            assert(!(kmer_relative_start < 0 && !allow_negatives));
+
+            lambda(kmer, instance, kmer_relative_start, path, *this);
         }
     };
 
     auto noop = [](NodeTraversal) { };
 
+    // the duplicates of a kmer can only come from the kpaths of the node it
+    // is seen from, so we only need to remember the kmers of one node at a time
+    auto by_node = [this, kmer_size, edge_max, parallel, &scratch, &handle_path, &noop](Node* n) {
+        KmerScratch& s = scratch[parallel ? omp_get_thread_num() : 0];
+        s.seen.clear();
+        for_each_kpath_of_node(n, kmer_size, edge_max, noop, noop,
+                               [&s, &handle_path](list<NodeTraversal>::iterator forward_node,
+                                                  list<NodeTraversal>& forward_path) {
+                                   handle_path(s, forward_node, forward_path);
+                               });
+    };
+
     if(node == nullptr) {
         // Look at all the kpaths
         if (parallel) {
-            for_each_kpath_parallel(kmer_size, edge_max, noop, noop, handle_path);
+            for_each_node_parallel(by_node);
         } else {
-            for_each_kpath(kmer_size, edge_max, noop, noop, handle_path);
+            for_each_node(by_node);
         }
     } else {
         // Look only at kpaths of the specified node
-        for_each_kpath_of_node(node, kmer_size, edge_max, noop, noop, handle_path);
+        by_node(node);
     }
 
 }
@@ -3942,95 +4553,115 @@ void VG::kmer_context(string& kmer,
 }
 
 void VG::prune_complex(int path_length, int edge_max, Node* head_node, Node* tail_node) {
-    vector<set<NodeTraversal> > prev_maxed_nodes;
-    vector<set<NodeTraversal> > next_maxed_nodes;
-#pragma omp parallel
-    {
-#pragma omp single
-        {
-            int threads = omp_get_num_threads();
-            prev_maxed_nodes.resize(threads);
-            next_maxed_nodes.resize(threads);
-        }
-    }
-    auto prev_maxed = [this, &prev_maxed_nodes](NodeTraversal node) {
-        int tid = omp_get_thread_num();
-        prev_maxed_nodes[tid].insert(node);
+    // Mark, by node index, the orientations in which we tried to go into each
+    // node and couldn't, going left (prev) and right (next). Bit 1 is the
+    // forward orientation and bit 2 the backward one.
+    vector<uint8_t> prev_maxed_nodes(graph.node_size(), 0);
+    vector<uint8_t> next_maxed_nodes(graph.node_size(), 0);
+    auto mark = [this](vector<uint8_t>& marks, NodeTraversal node) {
+        int i = node_index.find(node.node)->second;
+        uint8_t bit = 1 << node.backward;
+#pragma omp atomic
+        marks[i] |= bit;
     };
-    auto next_maxed = [this, &next_maxed_nodes](NodeTraversal node) {
-        int tid = omp_get_thread_num();
-        next_maxed_nodes[tid].insert(node);
+    auto prev_maxed = [&mark, &prev_maxed_nodes](NodeTraversal node) {
+        mark(prev_maxed_nodes, node);
+    };
+    auto next_maxed = [&mark, &next_maxed_nodes](NodeTraversal node) {
+        mark(next_maxed_nodes, node);
     };
     auto noop = [](list<NodeTraversal>::iterator node, list<NodeTraversal>& path) { };
     for_each_kpath_parallel(path_length, edge_max, prev_maxed, next_maxed, noop);
 
-    // What nodes will we destroy because we got into them with too much complexity?
-    set<Node*> to_destroy;
-
-    set<NodeTraversal> prev;
-    for (auto& p : prev_maxed_nodes) {
-        for (auto node : p) {
-            prev.insert(node);
-        }
+    // The head and tail stay whatever happens at them, since we rewire to them.
+    for (Node* n : { head_node, tail_node }) {
+        int i = node_index[n];
+        prev_maxed_nodes[i] = next_maxed_nodes[i] = 0;
     }
-    for (auto node : prev) {
-        // This node was prev-maxed, meaning we tried to go left into it and couldn't.
-        // We want to connect the end of the head node to everywhere we tried to come left from.
 
-        // We drop any links going into the other side of this node.
+    // What nodes will we destroy because we got into them with too much complexity?
+    vector<uint8_t> to_destroy(graph.node_size(), 0);
+    for (int64_t i = 0; i < graph.node_size(); ++i) {
+        to_destroy[i] = prev_maxed_nodes[i] || next_maxed_nodes[i];
+    }
+    auto destroyed = [this, &to_destroy](int64_t id) {
+        auto n = node_by_id.find(id);
+        return n != node_by_id.end() && to_destroy[node_index.find(n->second)->second];
+    };
 
-        if(node.backward) {
-            // Going left into it means coming to its start. True flags on the
-            // edges mean connecting to the start of the other nodes.
-            for (auto& e : edges_start(node.node)) {
-                create_edge(e.first, head_node->id(), e.second, true);
-            }
-        } else {
-            // Going left into it means coming to its end. True flags on the
-            // edges mean connecting to the ends of the other nodes.
-            for (auto& e : edges_end(node.node)) {
-                create_edge(head_node->id(), e.first, false, e.second);
+    // Work out the edges to the head and tail that replace the ones into the
+    // nodes we destroy, from the edges as they are now. Edges to other nodes
+    // we destroy would only go away again, so we don't make them.
+    vector<vector<pair<NodeSide, NodeSide>>> thread_rewired(omp_get_max_threads());
+#pragma omp parallel for schedule(dynamic, 1000)
+    for (int64_t i = 0; i < graph.node_size(); ++i) {
+        if (!to_destroy[i]) continue;
+        Node* node = graph.mutable_node(i);
+        auto& rewired = thread_rewired[omp_get_thread_num()];
+        // Each side of this node is described by the other node and whether
+        // the edge attaches to that node's start (on our end) or end (on our
+        // start). We drop any links going into the other side of this node.
+        if (prev_maxed_nodes[i] & 1) {
+            // Going left into it means coming to its end. Connect the end of
+            // the head node to everywhere we tried to come left from.
+            for (auto& e : edges_end(node)) {
+                if (!destroyed(e.first)) rewired.push_back(minmax(NodeSide(head_node->id(), true), NodeSide(e.first, e.second)));
             }
         }
-
-        // Remember to estroy the node. We might come to the same node in two directions.
-        to_destroy.insert(node.node);
-    }
-
-    set<NodeTraversal> next;
-    for (auto& n : next_maxed_nodes) {
-        for (auto node : n) {
-            next.insert(node);
+        if (prev_maxed_nodes[i] & 2) {
+            // Backward, going left into it means coming to its start.
+            for (auto& e : edges_start(node)) {
+                if (!destroyed(e.first)) rewired.push_back(minmax(NodeSide(head_node->id(), true), NodeSide(e.first, !e.second)));
+            }
         }
-    }
-    for (auto node : next) {
-        // This node was next-maxed, meaning we tried to go right into it and couldn't.
-        // We want to connect the start of the tail node to everywhere we tried to come right from.
-
-        // We drop any links going into the other side of this node.
-
-        if(node.backward) {
-            // Going right into it means coming to its end. True flags on the
-            // edges mean connecting to the end of the other nodes.
-            for (auto& e : edges_end(node.node)) {
-                create_edge(tail_node->id(), e.first, false, e.second);
+        if (next_maxed_nodes[i] & 1) {
+            // Going right into it means coming to its start. Connect the start
+            // of the tail node to everywhere we tried to come right from.
+            for (auto& e : edges_start(node)) {
+                if (!destroyed(e.first)) rewired.push_back(minmax(NodeSide(tail_node->id(), false), NodeSide(e.first, !e.second)));
             }
-        } else {
-            // Going right into it means coming to its start. True flags on the
-            // edges mean connecting to the starts of the other nodes.
-            for (auto& e : edges_start(node.node)) {
-                create_edge(e.first, head_node->id(), e.second, true);
+        }
+        if (next_maxed_nodes[i] & 2) {
+            // Backward, going right into it means coming to its end.
+            for (auto& e : edges_end(node)) {
+                if (!destroyed(e.first)) rewired.push_back(minmax(NodeSide(tail_node->id(), false), NodeSide(e.first, e.second)));
             }
         }
-
-        // Remember to estroy the node. We might come to the same node in two directions.
-        to_destroy.insert(node.node);
+    }
+    set<pair<NodeSide, NodeSide>> new_edges;
+    for (auto& rewired : thread_rewired) {
+        for (auto& sides : rewired) {
+            if (!get_edge(sides)) new_edges.insert(sides);
+        }
     }
 
-    for(Node* n : to_destroy) {
-        // Destroy all the nodes we wanted to destroy.
-        destroy_node(n);
+    // Now drop the destroyed nodes, and every edge on them, in one pass over
+    // the graph that keeps the rest in order, and index the result once.
+    vector<uint8_t> edge_destroyed(graph.edge_size(), 0);
+#pragma omp parallel for
+    for (int64_t i = 0; i < graph.edge_size(); ++i) {
+        Edge* edge = graph.mutable_edge(i);
+        edge_destroyed[i] = destroyed(edge->from()) || destroyed(edge->to());
+    }
+    int64_t kept = 0;
+    for (int64_t i = 0; i < graph.node_size(); ++i) {
+        if (!to_destroy[i]) graph.mutable_node()->SwapElements(i, kept++);
+    }
+    while (graph.node_size() > kept) graph.mutable_node()->RemoveLast();
+    kept = 0;
+    for (int64_t i = 0; i < graph.edge_size(); ++i) {
+        if (!edge_destroyed[i]) graph.mutable_edge()->SwapElements(i, kept++);
     }
+    while (graph.edge_size() > kept) graph.mutable_edge()->RemoveLast();
+    for (auto& sides : new_edges) {
+        Edge* edge = graph.add_edge();
+        edge->set_from(sides.first.node);
+        edge->set_to(sides.second.node);
+        // Leave from the first side, and arrive at the second.
+        if (!sides.first.is_end) edge->set_from_start(true);
+        if (sides.second.is_end) edge->set_to_end(true);
+    }
+    rebuild_indexes();
 
     for (auto* n : head_nodes()) {
         if (n != head_node) {
@@ -4214,188 +4845,278 @@ while N is nonempty do
 void VG::topological_sort(deque<NodeTraversal>& l) {
     //assert(is_valid());
 
-    // using a map instead of a set ensures a stable sort across different systems
-    map<int64_t, NodeTraversal> s;
-
-    // We find the head and tails, if there are any
-    vector<Node*> heads;
-    head_nodes(heads);
-    vector<Node*> tails;
-    tail_nodes(tails);
-
-    // We'll fill this in with the heads, so we can orient things according to
-    // them first, and then arbitrarily. We ignore tails since we only orient
-    // right from nodes we pick.
-    // Maps from node ID to first orientation we suggested for it.
-    map<int64_t, NodeTraversal> seeds;
-    for(Node* head : heads) {
-        seeds[head->id()] = NodeTraversal(head, false);
+    int64_t node_count = graph.node_size();
+
+    // Number the nodes by their rank in id order, which gives us a stable sort
+    // across different systems, and work on flat arrays indexed by rank.
+    vector<Node*> nodes(node_count);
+    for (int64_t i = 0; i < node_count; ++i) {
+        nodes[i] = graph.mutable_node(i);
+    }
+    std::sort(nodes.begin(), nodes.end(), [](Node* a, Node* b) { return a->id() < b->id(); });
+    hash_map<int64_t, int64_t> rank;
+    for (int64_t r = 0; r < node_count; ++r) {
+        rank[nodes[r]->id()] = r;
+    }
+
+    // Copy the edge index into one array, keeping its order, with the edges
+    // on the start of node r in side 2 * r and those on its end in side 2 * r + 1.
+    // Each entry is the other node's rank and the relative orientation, as in
+    // the index, and removing one works just like unindexing it. Orphan edges,
+    // to nodes that aren't in the graph, are left out.
+    vector<int64_t> side_begin(2 * node_count + 1, 0);
+    vector<int64_t> side_size(2 * node_count);
+    auto in_graph = [&rank](const pair<int64_t, bool>& e) { return rank.find(e.first) != rank.end(); };
+    for (int64_t r = 0; r < node_count; ++r) {
+        auto& start = edges_start(nodes[r]);
+        auto& end = edges_end(nodes[r]);
+        side_size[2 * r] = std::count_if(start.begin(), start.end(), in_graph);
+        side_size[2 * r + 1] = std::count_if(end.begin(), end.end(), in_graph);
+    }
+    for (int64_t i = 0; i < 2 * node_count; ++i) {
+        side_begin[i + 1] = side_begin[i] + side_size[i];
+    }
+    vector<pair<int64_t, bool>> side_edges(side_begin.back());
+#pragma omp parallel for schedule(dynamic, 1024)
+    for (int64_t r = 0; r < node_count; ++r) {
+        int64_t k = side_begin[2 * r];
+        for (auto& e : edges_start(nodes[r])) {
+            auto other = rank.find(e.first);
+            if (other != rank.end()) side_edges[k++] = make_pair(other->second, e.second);
+        }
+        for (auto& e : edges_end(nodes[r])) {
+            auto other = rank.find(e.first);
+            if (other != rank.end()) side_edges[k++] = make_pair(other->second, e.second);
+        }
     }
-
-    // We will use a std::map copy of node_by_id as our set of unvisited nodes,
-    // and remove index entries from it when we visit nodes. It will be rebuilt
-    // when we rebuild the indexes later. We know its order will be fixed across
-    // systems.
-    map<int64_t, Node*> unvisited;
-    // Fill it in, we can't use the copy constructor since std::map doesn't speak vg::hash_map
-    // TODO: is the vg::hash_map order fixed across systems?
-    for_each_node([&](Node* node) {
-        unvisited[node->id()] = node;
-    });
-
-    // How many nodes have we ordered and oriented?
-    int64_t seen = 0;
-
-    while(!unvisited.empty()) {
-
-        // Put something in s. First go through seeds until we can find one
-        // that's not already oriented.
-        while(s.empty() && !seeds.empty()) {
-            // Look at the first seed
-            NodeTraversal first_seed = (*seeds.begin()).second;
-
-            if(unvisited.count(first_seed.node->id())) {
-                // We have an unvisited seed. Use it
-#ifdef debug
-#pragma omp critical (cerr)
-                cerr << "Starting from seed " << first_seed.node->id() << " orientation " << seeds.front().backward << endl;
-#endif
-
-                s[first_seed.node->id()] = first_seed;
-                unvisited.erase(first_seed.node->id());
-            }
-            // Whether we used the seed or not, don't keep it around
-            seeds.erase(seeds.begin());
+    // The sides we come into and leave an oriented node by
+    auto left_side = [](int64_t r, bool backward) { return 2 * r + backward; };
+    auto right_side = [](int64_t r, bool backward) { return 2 * r + !backward; };
+    // Remove the edge between the given side and the given entry on it
+    auto remove_edge = [&](int64_t side, int64_t other, bool relative_orientation) {
+        int64_t r = side / 2;
+        auto remove_entry = [&](int64_t side, int64_t other) {
+            auto first = side_edges.begin() + side_begin[side];
+            auto last = first + side_size[side];
+            auto found = std::find(first, last, make_pair(other, relative_orientation));
+            std::swap(*found, *(last - 1));
+            --side_size[side];
+        };
+        remove_entry(side, other);
+        // The other end is on a start if we are on the start and the
+        // orientation doesn't change, or we're on the end and it does.
+        int64_t other_side = 2 * other + ((side % 2 == 1) == relative_orientation);
+        if (other_side != side) {
+            // It's only in the index once if it's a self loop on a single side.
+            remove_entry(other_side, r);
         }
+    };
 
-        if(s.empty()) {
-            // If we couldn't find a seed, just grab any old node.
-            // Since map order is stable across systems, we can take the first node by id and put it locally forward.
-#ifdef debug
-#pragma omp critical (cerr)
-            cerr << "Starting from arbitrary node " << unvisited.begin()->first << " locally forward" << endl;
-#endif
-
-            s[unvisited.begin()->first] = NodeTraversal(unvisited.begin()->second, false);
-            unvisited.erase(unvisited.begin()->first);
+    // Find the weakly connected components, which we can sort independently.
+    vector<int64_t> parent(node_count);
+    for (int64_t r = 0; r < node_count; ++r) parent[r] = r;
+    auto find_root = [&parent](int64_t r) {
+        while (parent[r] != r) {
+            parent[r] = parent[parent[r]];
+            r = parent[r];
         }
+        return r;
+    };
+    for (int64_t r = 0; r < node_count; ++r) {
+        for (int64_t k = side_begin[2 * r]; k < side_begin[2 * r + 2]; ++k) {
+            int64_t a = find_root(r), b = find_root(side_edges[k].first);
+            if (a != b) parent[max(a, b)] = min(a, b);
+        }
+    }
+    // Lay out each component's nodes together, in rank order.
+    vector<int64_t> component(node_count);
+    vector<int64_t> component_begin;
+    vector<int64_t> component_of_root(node_count, -1);
+    for (int64_t r = 0; r < node_count; ++r) {
+        int64_t root = find_root(r);
+        if (component_of_root[root] == -1) {
+            component_of_root[root] = component_begin.size();
+            component_begin.push_back(0);
+        }
+        component[r] = component_of_root[root];
+        ++component_begin[component[r]];
+    }
+    int64_t component_count = component_begin.size();
+    for (int64_t c = 0, total = 0; c < component_count; ++c) {
+        int64_t size = component_begin[c];
+        component_begin[c] = total;
+        total += size;
+    }
+    component_begin.push_back(node_count);
+    vector<int64_t> component_nodes(node_count);
+    {
+        vector<int64_t> filled(component_begin.begin(), component_begin.end() - 1);
+        for (int64_t r = 0; r < node_count; ++r) {
+            component_nodes[filled[component[r]]++] = r;
+        }
+    }
 
-        while (!s.empty()) {
-            // Grab an oriented node
-            NodeTraversal n = s.begin()->second;
-            s.erase(n.node->id());
-            l.push_back(n);
-            ++seen;
-#ifdef debug
-#pragma omp critical (cerr)
-            cerr << "Using oriented node " << n.node->id() << " orientation " << n.backward << endl;
-#endif
-
-            // See if it has an edge from its start to the start of some node
-            // where both were picked as places to break into cycles. A
-            // reversing self loop on a cycle entry point is a special case of
-            // this.
-            vector<NodeTraversal> prev;
-            nodes_prev(n, prev);
-            for(NodeTraversal& prev_node : prev) {
-                if(!unvisited.count(prev_node.node->id())) {
-#ifdef debug
-#pragma omp critical (cerr)
-                    cerr << "\tHas left-side edge to cycle entry point " << prev_node.node->id()
-                         << " orientation " << prev_node.backward << endl;
-#endif
-
-                    // Unindex it
-                    Edge* bad_edge = get_edge(prev_node, n);
-                    unindex_edge_by_node_sides(bad_edge);
+    // Each component's part of the order, in its slots of order, made of
+    // runs that each start at a seed or at an arbitrary node.
+    struct Run {
+        int64_t start;
+        bool from_seed;
+        int64_t end;
+    };
+    vector<pair<int64_t, bool>> order(node_count);
+    vector<vector<Run>> component_runs(component_count);
+    // Whether each node has been put into s (and so out of N), whether it
+    // is waiting as a seed, and the orientations we picked for it.
+    vector<uint8_t> visited(node_count, 0);
+    vector<uint8_t> is_seed(node_count, 0);
+    vector<uint8_t> seed_backward(node_count, 0);
+    vector<uint8_t> s_backward(node_count, 0);
+
+    // Walk one component. The graph-wide algorithm only ever works on one
+    // component at a time, and always picks the lowest ranked node it can, so
+    // this makes the same runs it would.
+    auto sort_component = [&](int64_t c) {
+        typedef priority_queue<int64_t, vector<int64_t>, greater<int64_t>> rank_queue;
+        rank_queue s;
+        // We start from the heads so we can orient things according to them
+        // first, and then arbitrarily, from the first node we are shown in
+        // each orientation.
+        rank_queue seeds;
+        for (int64_t i = component_begin[c]; i < component_begin[c + 1]; ++i) {
+            int64_t r = component_nodes[i];
+            if (side_size[2 * r] == 0) {
+                is_seed[r] = 1;
+                seeds.push(r);
+            }
+        }
+        int64_t next_unvisited = component_begin[c];
+        int64_t placed = component_begin[c];
+        vector<pair<int64_t, bool>> adjacent;
+
+        while (placed < component_begin[c + 1]) {
+            Run run;
+            run.from_seed = false;
+            // Put something in s. First go through seeds until we can find
+            // one that's not already oriented.
+            while (s.empty() && !seeds.empty()) {
+                int64_t r = seeds.top();
+                seeds.pop();
+                is_seed[r] = 0;
+                if (!visited[r]) {
+                    visited[r] = 1;
+                    s_backward[r] = seed_backward[r];
+                    s.push(r);
+                    run.from_seed = true;
                 }
             }
+            if (s.empty()) {
+                // If we couldn't find a seed, take the first node by id and put it locally forward.
+                while (visited[component_nodes[next_unvisited]]) ++next_unvisited;
+                int64_t r = component_nodes[next_unvisited];
+                visited[r] = 1;
+                s_backward[r] = 0;
+                s.push(r);
+            }
+            run.start = s.top();
+
+            while (!s.empty()) {
+                // Grab an oriented node
+                int64_t r = s.top();
+                s.pop();
+                bool backward = s_backward[r];
+                order[placed++] = make_pair(r, backward);
+
+                // Drop any edge from its left side to a node we already
+                // picked as a place to break into a cycle. A reversing self
+                // loop on a cycle entry point is a special case of this.
+                int64_t side = left_side(r, backward);
+                adjacent.assign(side_edges.begin() + side_begin[side],
+                                side_edges.begin() + side_begin[side] + side_size[side]);
+                for (auto& prev : adjacent) {
+                    if (visited[prev.first]) {
+                        remove_edge(side, prev.first, prev.second);
+                    }
+                }
 
-            // All other connections and self loops are handled by looking off the right side.
-
-            // See what all comes next, minus deleted edges.
-            vector<NodeTraversal> next;
-            nodes_next(n, next);
-
-            for(NodeTraversal& next_node : next) {
-
-#ifdef debug
-#pragma omp critical (cerr)
-                cerr << "\tHas edge to " << next_node.node->id() << " orientation " << next_node.backward << endl;
-#endif
-
-                // Unindex the edge connecting these nodes in this order and
-                // relative orientation, so we can't traverse it with
-                // nodes_next/nodes_prev.
-
-                // Grab the edge
-                Edge* edge = get_edge(n, next_node);
-
-                // Unindex it
-                unindex_edge_by_node_sides(edge);
-
-                if(unvisited.count(next_node.node->id())) {
-                    // We haven't already started here as an arbitrary cycle entry point
-
-#ifdef debug
-#pragma omp critical (cerr)
-                    cerr << "\t\tAnd node hasn't been visited yet" << endl;
-#endif
-
-                    if(node_count_prev(next_node) == 0) {
-
-#ifdef debug
-#pragma omp critical (cerr)
-                        cerr << "\t\t\tIs last incoming edge" << endl;
-#endif
-                        // Keep this orientation and put it here
-                        s[next_node.node->id()] = next_node;
-                        // Remember that we've visited and oriented this node, so we
-                        // don't need to use it as a seed.
-                        unvisited.erase(next_node.node->id());
-
-                    } else if(!seeds.count(next_node.node->id())) {
-                        // We came to this node in this orientation; when we need a
-                        // new node and orientation to start from (i.e. an entry
-                        // point to the node's cycle), we might as well pick this
-                        // one.
-                        // Only take it if we don't already know of an orientation for this node.
-                        seeds[next_node.node->id()] = next_node;
-
-#ifdef debug
-#pragma omp critical (cerr)
-                        cerr << "\t\t\tSuggests seed " << next_node.node->id() << " orientation " << next_node.backward << endl;
-#endif
+                // All other connections and self loops are handled by looking
+                // off the right side, removing each edge as we follow it.
+                side = right_side(r, backward);
+                adjacent.assign(side_edges.begin() + side_begin[side],
+                                side_edges.begin() + side_begin[side] + side_size[side]);
+                for (auto& next : adjacent) {
+                    remove_edge(side, next.first, next.second);
+                    int64_t o = next.first;
+                    bool o_backward = next.second != backward;
+                    if (!visited[o]) {
+                        if (side_size[left_side(o, o_backward)] == 0) {
+                            // That was the last incoming edge, so keep this
+                            // orientation and put it here.
+                            visited[o] = 1;
+                            s_backward[o] = o_backward;
+                            s.push(o);
+                        } else if (!is_seed[o]) {
+                            // When we need a new node and orientation to start
+                            // from (i.e. an entry point to the node's cycle),
+                            // we might as well pick this one.
+                            is_seed[o] = 1;
+                            seed_backward[o] = o_backward;
+                            seeds.push(o);
+                        }
                     }
-                } else {
-#ifdef debug
-#pragma omp critical (cerr)
-                    cerr << "\t\tAnd node was already visited (to break a cycle)" << endl;
-#endif
                 }
             }
-
-            // The caller may put us in a progress context with the denominator
-            // being the number of nodes in the graph.
-            update_progress(seen);
+            run.end = placed;
+            component_runs[c].push_back(run);
         }
+    };
+
+#pragma omp parallel for schedule(dynamic, 1) if (component_count > 1)
+    for (int64_t c = 0; c < component_count; ++c) {
+        sort_component(c);
     }
 
-    // There should be no edges left in the index
-    if(!edges_on_start.empty() || !edges_on_end.empty()) {
+    // There should be no edges left
+    for (int64_t i = 0; i < 2 * node_count; ++i) {
+        if (side_size[i] != 0) {
 #pragma omp critical (cerr)
-        {
-            cerr << "Error: edges remainin after topological sort and cycle breaking" << endl;
-            std::ofstream out("fail.vg");
-            serialize_to_ostream(out);
-            out.close();
+            {
+                cerr << "Error: edges remainin after topological sort and cycle breaking" << endl;
+                std::ofstream out("fail.vg");
+                serialize_to_ostream(out);
+                out.close();
+            }
+            exit(1);
         }
-        exit(1);
     }
 
-    // we have destroyed the graph's edge and node index to ensure its order
-    // rebuild the indexes
-    rebuild_indexes();
+    // Now put the runs together in the order the graph-wide walk would have
+    // taken them: the lowest seed of any component if there is one, and
+    // otherwise the lowest node left anywhere.
+    typedef tuple<bool, int64_t, int64_t> run_key; // not from seed, start, component
+    priority_queue<run_key, vector<run_key>, greater<run_key>> next_runs;
+    vector<size_t> run_cursor(component_count, 0);
+    for (int64_t c = 0; c < component_count; ++c) {
+        auto& run = component_runs[c].front();
+        next_runs.emplace(!run.from_seed, run.start, c);
+    }
+    int64_t seen = 0;
+    while (!next_runs.empty()) {
+        int64_t c = get<2>(next_runs.top());
+        next_runs.pop();
+        auto& runs = component_runs[c];
+        auto& run = runs[run_cursor[c]];
+        int64_t begin = run_cursor[c] == 0 ? component_begin[c] : runs[run_cursor[c] - 1].end;
+        for (int64_t i = begin; i < run.end; ++i) {
+            l.push_back(NodeTraversal(nodes[order[i].first], order[i].second));
+            // The caller may put us in a progress context with the denominator
+            // being the number of nodes in the graph.
+            update_progress(++seen);
+        }
+        if (++run_cursor[c] < runs.size()) {
+            auto& next = runs[run_cursor[c]];
+            next_runs.emplace(!next.from_seed, next.start, c);
+        }
+    }
 }
 
 void VG::orient_nodes_forward(set<int64_t>& nodes_flipped) {
@@ -4408,109 +5129,123 @@ void VG::orient_nodes_forward(set<int64_t>& nodes_flipped) {
     deque<NodeTraversal> order_and_orientation;
     topological_sort(order_and_orientation);
 
-    // These are the node IDs we've visited so far
-    set<int64_t> visited;
-
-    for(auto& traversal : order_and_orientation) {
-        // Say we visited this node
-#ifdef debug
-#pragma omp critical (cerr)
-        cerr << "Visiting " << traversal.node->id() << endl;
-#endif
-        visited.insert(traversal.node->id());
-
-        // Make sure this node is the "from" in all its edges with un-visited nodes.
-
-        if(traversal.backward) {
-            // We need to flip this node around.
-#ifdef debug
-#pragma omp critical (cerr)
-            cerr << "Flipped node " << traversal.node->id() << endl;
-#endif
+    for (auto& traversal : order_and_orientation) {
+        if (traversal.backward) {
             // Say we flipped it
             nodes_flipped.insert(traversal.node->id());
+        }
+    }
 
+#pragma omp parallel for
+    for (int64_t k = 0; k < order_and_orientation.size(); ++k) {
+        if (order_and_orientation[k].backward) {
             // Flip the sequence
-            traversal.node->set_sequence(reverse_complement(traversal.node->sequence()));
-
+            Node* node = order_and_orientation[k].node;
+            node->set_sequence(reverse_complement(node->sequence()));
         }
+    }
 
-        // Get all the edges
-        vector<Edge*> node_edges;
-        edges_of_node(traversal.node, node_edges);
-        
-        // We need to unindex all the edges we're going to change before any of
-        // them get re-indexed. Otherwise, we might have to try to hold two of
-        // the same edge in the index at the same time, if one edge is fixed up
-        // to be equal to another original edge before the other original edge
-        // is fixed.
-        
-        // Edges that go from unvisited things to here need to be flipped from/to.
-        vector<Edge*> edges_to_flip;
-        copy_if(node_edges.begin(), node_edges.end(), back_inserter(edges_to_flip), [&](Edge* edge) {
-            // We only need to flip the edges that are from things we haven't visited yet to here.
-            return edge->to() == traversal.node->id() && visited.count(edge->from()) == 0;
-        });
-        
-        for(Edge* edge : (traversal.backward ? node_edges : edges_to_flip)) {
-            // Unindex every edge if we flipped the node, or only the edges we are flipping otherwise
-            unindex_edge_by_node_sides(edge);
-
-#ifdef debug
-#pragma omp critical (cerr)
-            cerr << "Unindexed edge " << edge->from() << (edge->from_start() ? " start" : " end") 
-                 << " -> " << edge->to() << (edge->to_end() ? " end" : " start") << endl;
-#endif
+    // Work out what becomes of the edges, and write it back.
+    vector<pair<NodeSide, NodeSide>> oriented_edges;
+    vector<int64_t> kept;
+    orient_edges_forward(order_and_orientation, oriented_edges, kept);
+#pragma omp parallel for
+    for (int64_t i = 0; i < graph.edge_size(); ++i) {
+        Edge* edge = graph.mutable_edge(i);
+        edge->set_from(oriented_edges[i].first.node);
+        edge->set_from_start(!oriented_edges[i].first.is_end);
+        edge->set_to(oriented_edges[i].second.node);
+        edge->set_to_end(oriented_edges[i].second.is_end);
+    }
+
+    // Move the edges we keep into place, in order, and drop the rest.
+    int64_t edge_count = graph.edge_size();
+    vector<int64_t> place_of(edge_count);
+    vector<int64_t> edge_at(edge_count);
+    for (int64_t i = 0; i < edge_count; ++i) {
+        place_of[i] = edge_at[i] = i;
+    }
+    for (int64_t i = 0; i < kept.size(); ++i) {
+        int64_t j = place_of[kept[i]];
+        if (j != i) {
+            graph.mutable_edge()->SwapElements(i, j);
+            int64_t moved = edge_at[i];
+            edge_at[j] = moved;
+            place_of[moved] = j;
+            edge_at[i] = kept[i];
+            place_of[kept[i]] = i;
         }
-        
-        for(Edge* edge : edges_to_flip) {
-            // Flip around all the edges that need flipping
-            // Flip the nodes
-            int64_t temp_id = edge->from();
-            edge->set_from(edge->to());
-            edge->set_to(temp_id);
-
-            // Move the directionality flags, but invert both.
-            bool temp_orientation = !edge->from_start();
-            edge->set_from_start(!edge->to_end());
-            edge->set_to_end(temp_orientation);
+    }
+    while (graph.edge_size() > kept.size()) {
 #ifdef debug
+        Edge* e = graph.mutable_edge(graph.edge_size() - 1);
 #pragma omp critical (cerr)
-            cerr << "Reversed edge direction to " << edge->from() << (edge->from_start() ? " start" : " end") 
-                 << " -> " << edge->to() << (edge->to_end() ? " end" : " start") << endl;
+        cerr << "Removed cycle edge " << e->from() << "->" << e->to() << endl;
 #endif
+        graph.mutable_edge()->RemoveLast();
+    }
+    rebuild_indexes();
+
+}
+
+void VG::orient_edges_forward(deque<NodeTraversal>& order_and_orientation,
+                              vector<pair<NodeSide, NodeSide>>& oriented_edges,
+                              vector<int64_t>& kept) {
+
+    // Where each node comes in the order
+    hash_map<int64_t, int64_t> place;
+    for (int64_t k = 0; k < order_and_orientation.size(); ++k) {
+        place[order_and_orientation[k].node->id()] = k;
+    }
+
+    // Visiting the nodes in order, we make each one the "from" in all its
+    // edges with nodes we haven't visited yet, and flip the ends of the edges
+    // on the nodes we flip around. What happens to an edge only depends on
+    // its own two nodes, so we can go edge by edge, visiting its earlier node
+    // and then its later one. Self loops get removed below anyway.
+    oriented_edges.resize(graph.edge_size());
+#pragma omp parallel for
+    for (int64_t i = 0; i < graph.edge_size(); ++i) {
+        const Edge& edge = graph.edge(i);
+        int64_t from = edge.from();
+        int64_t to = edge.to();
+        bool from_start = edge.from_start();
+        bool to_end = edge.to_end();
+        auto from_place = place.find(from);
+        auto to_place = place.find(to);
+        if (from_place == place.end() || to_place == place.end()) {
+            // An orphan edge, with a node that isn't in the graph. Leave it
+            // pointing from the start of a node, so it's removed below.
+            oriented_edges[i] = make_pair(NodeSide(from, false), NodeSide(to, false));
+            continue;
         }
-        
-        if(traversal.backward) {
-            for(Edge* edge : node_edges) {
-                // Now that all the edges have the correct to and from, flip the
-                // appropriate from_start and to_end flags for the end(s) on this
-                // node, since we flipped the node.
-                
-                if(edge->to() == traversal.node->id()) {
-                    edge->set_to_end(!edge->to_end());
+        if (from != to) {
+            for (int64_t visiting : { min(from_place->second, to_place->second),
+                                      max(from_place->second, to_place->second) }) {
+                auto& traversal = order_and_orientation[visiting];
+                int64_t id = traversal.node->id();
+                if (to == id && from_place->second > visiting) {
+                    // Edges that go from unvisited things to here need to be flipped from/to.
+                    swap(from, to);
+                    // Move the directionality flags, but invert both.
+                    bool temp_orientation = !from_start;
+                    from_start = !to_end;
+                    to_end = temp_orientation;
                 }
-                if(edge->from() == traversal.node->id()) {
-                    edge->set_from_start(!edge->from_start());
+                if (traversal.backward) {
+                    // Now that the edge has the correct to and from, flip the
+                    // appropriate from_start and to_end flags for the end on
+                    // this node, since we flipped the node.
+                    if (to == id) {
+                        to_end = !to_end;
+                    }
+                    if (from == id) {
+                        from_start = !from_start;
+                    }
                 }
             }
         }
-        
-        for(Edge* edge : (traversal.backward ? node_edges : edges_to_flip)) {
-            // Reindex exactly what was unindexed
-            index_edge_by_node_sides(edge);
-
-#ifdef debug
-#pragma omp critical (cerr)
-            cerr << "Reindexed edge " << edge->from() << (edge->from_start() ? " start" : " end") 
-                 << " -> " << edge->to() << (edge->to_end() ? " end" : " start") << endl;
-#endif
-        }
-        
-        // It should always work out that the edges are from end to
-        // start when we are done, but right now they might not be,
-        // because the nodes at the other ends may still need to be
-        // flipped themselves.
+        oriented_edges[i] = make_pair(NodeSide(from, !from_start), NodeSide(to, to_end));
     }
 
     // We now know there are no edges from later nodes to earlier nodes. But
@@ -4518,22 +5253,25 @@ void VG::orient_nodes_forward(set<int64_t>& nodes_flipped) {
     // with both end flags set, will cause problems. So remove those.
     // This works out to just clearing any edges with from_start or to_end set.
     // We also need to clear otherwise-normal-looking self loops here.
-    vector<Edge*> to_remove;
-    for_each_edge([&](Edge* e) {
-        if(e->from_start() || e->to_end() || e->from() == e->to()) {
+    // Each one is taken out the way destroy_edge would, by swapping it with
+    // the last edge, which fixes the order the rest are left in.
+    int64_t edge_count = oriented_edges.size();
+    kept.resize(edge_count);
+    vector<int64_t> place_of(edge_count);
+    for (int64_t i = 0; i < edge_count; ++i) {
+        place_of[i] = kept[i] = i;
+    }
+    for (int64_t i = 0; i < edge_count; ++i) {
+        auto& sides = oriented_edges[i];
+        if (!sides.first.is_end || sides.second.is_end || sides.first.node == sides.second.node) {
             // gssw won't know how to read this. Get rid of it.
-            to_remove.push_back(e);
+            int64_t t = place_of[i];
+            int64_t moved = kept.back();
+            kept[t] = moved;
+            place_of[moved] = t;
+            kept.pop_back();
         }
-    });
-
-    for(Edge* edge : to_remove) {
-#ifdef debug
-#pragma omp critical (cerr)
-        cerr << "Removed cycle edge " << edge->from() << "->" << edge->to() << endl;
-#endif
-        destroy_edge(edge);
     }
-
 }
 
 } // end namespace
@@ -23,7 +23,6 @@
 #include "hash_map.hpp"
 
 #include "progress_bar.hpp"
-#include "lru_cache.h"
 
 #include "Variant.h"
 #include "Fasta.h"
@@ -239,6 +238,20 @@ public:
        int vars_per_region,
        int max_node_size = 0,
        bool showprog = false);
+    // Construct from VCF without holding the whole graph in memory. Variants
+    // are read in windows, chunks of the graph are built in parallel, and each
+    // chunk is handed to emit with its ids already moved into the final id space
+    // along with a chunk id. Chunks may be emitted from several threads at once;
+    // written out in order of chunk id they form the graph in topologically
+    // sorted, compact id order. Unlike the constructor above, the ids depend on
+    // the region size. This object is only used to show progress.
+    void construct_streaming(vcflib::VariantCallFile& variantCallFile,
+                             FastaReference& reference,
+                             string& target,
+                             bool target_is_chrom,
+                             int vars_per_region,
+                             int max_node_size,
+                             function<void(Graph&, uint64_t)>& emit);
     void from_alleles(const map<long, set<vcflib::VariantAllele> >& altp,
                       string& seq,
                       string& chrom);
@@ -363,6 +376,11 @@ public:
     // then attach tails of this graph to the heads of the other, and extend(g)
     void append(VG& g);
 
+    // join the graphs end to end into this empty graph, as appending each of
+    // them in order would, but laying them out in a single parallel pass
+    // the contents of the given graphs are moved out, so they are left empty
+    void append_chunks(vector<VG*>& chunks);
+
     // don't append or join the nodes in the graphs
     // just ensure that ids are unique, then apply extend
     void combine(VG& g);
@@ -378,6 +396,30 @@ public:
               map<pair<int64_t, size_t>, pair<int64_t, size_t> >& del_f,
               map<pair<int64_t, size_t>, pair<int64_t, size_t> >& del_t);
     void edit(const vector<Path>& paths);
+
+    // Read all the variants in the VCF into alleles, by sequence name and
+    // 0-based position, skipping any that aren't DNA.
+    void vcf_to_alleles(vcflib::VariantCallFile& variantCallFile,
+                        map<string, map<long, set<vcflib::VariantAllele> > >& alleles);
+    // Add variants to an existing graph. The alleles of each sequence are
+    // placed against the path of the same name, which must run forward and
+    // without edits along the reference from its first base, as vg construct
+    // leaves it. Reference nodes are divided where the alleles need breaks, and
+    // alternate nodes and deletion edges are wired to everything already
+    // attached at the same positions. Alleles that are already present are
+    // skipped. Fills in the ids of the nodes that were removed, the nodes that
+    // were added, and the surviving nodes whose edges changed.
+    void add_alleles(const map<string, map<long, set<vcflib::VariantAllele> > >& alleles,
+                     set<int64_t>& removed,
+                     set<int64_t>& added,
+                     set<int64_t>& updated);
+    // Get the ids of the nodes that add_alleles would divide or attach new
+    // edges to, before it is run.
+    void nodes_at_alleles(const map<string, map<long, set<vcflib::VariantAllele> > >& alleles,
+                          set<int64_t>& ids);
+    // Get the ids of the given nodes and all the nodes that have less than
+    // length bp between them and one of the given nodes, in either direction.
+    void nodes_near(const set<int64_t>& ids, int length, set<int64_t>& near);
     
     // Add in the given node, by value
     void add_node(Node& node);
@@ -528,14 +570,20 @@ public:
     // orientations changed. TODO: update the paths that touch nodes that
     // flipped around
     void orient_nodes_forward(set<int64_t>& nodes_flipped);
-
-    // Align to the graph. The graph must be acyclic and contain only end-to-start edges.
-    // Will modify the graph by re-ordering the nodes.
+    // Work out what orient_nodes_forward would do to the edges, given the
+    // order and orientation from topological_sort, without changing the
+    // graph. Fills oriented_edges with the sides each edge would then link
+    // (from first), and kept with the indexes of the edges that would be
+    // left, in the order they would be left in.
+    void orient_edges_forward(deque<NodeTraversal>& order_and_orientation,
+                              vector<pair<NodeSide, NodeSide>>& oriented_edges,
+                              vector<int64_t>& kept);
+
+    // Align to the graph. The nodes are oriented and ordered as
+    // orient_nodes_forward and sort would, but on the side, so the graph is
+    // not modified and many threads may align against it at once.
     Alignment& align(Alignment& alignment);
     Alignment align(string& sequence);
-    void destroy_alignable_graph(void);
-
-    GSSWAligner* gssw_aligner;
 
     // returns all node-crossing paths with up to length across node boundaries
     // considers each node in forward orientation to produce the kpaths around it
@@ -578,19 +626,26 @@ public:
     void kpaths_of_node(int64_t node_id, vector<Path>& paths, int length, int edge_max,
                         function<void(NodeTraversal)> prev_maxed, function<void(NodeTraversal)> next_maxed);
     // Given an oriented start node, a length in bp, a maximum number of edges
-    // to cross, and a stack of nodes visited so far, fill in the set of paths
+    // to cross, and a postfix of nodes to follow it, fill in the set of paths
     // with all the paths starting at the oriented start node and going left no
     // longer than the specified length, calling maxed_nodes on nodes which
     // can't be visited due to the edge-crossing limit. Produces paths ending
     // with the specified node.
-    // TODO: postfix should not be (potentially) copied on every call.
     void prev_kpaths_from_node(NodeTraversal node, int length, int edge_max, bool edge_bounding,
-                               list<NodeTraversal> postfix, set<list<NodeTraversal> >& paths,
+                               const list<NodeTraversal>& postfix, set<list<NodeTraversal> >& paths,
                                function<void(NodeTraversal)>& maxed_nodes);
     // Do the same as prec_kpaths_from_node, except going right, producing a path starting with the specified node.
     void next_kpaths_from_node(NodeTraversal node, int length, int edge_max, bool edge_bounding,
-                               list<NodeTraversal> prefix, set<list<NodeTraversal> >& paths,
+                               const list<NodeTraversal>& prefix, set<list<NodeTraversal> >& paths,
                                function<void(NodeTraversal)>& maxed_nodes);
+    // The walk behind both of the above, without recursion or copying. Calls
+    // lambda with the stack of nodes from the start node outwards (going left
+    // or right) for each path found. The stack is scratch space, reused
+    // between calls.
+    void kpath_extensions(NodeTraversal node, int length, int edge_max, bool edge_bounding, bool go_left,
+                          function<void(NodeTraversal)>& maxed_nodes,
+                          vector<NodeTraversal>& stack,
+                          const function<void(vector<NodeTraversal>&)>& lambda);
 
     void paths_between(Node* from, Node* to, vector<Path>& paths);
     void paths_between(int64_t from, int64_t to, vector<Path>& paths);
@@ -771,6 +826,18 @@ public:
 private:
 
     void init(void); // setup, ensures that gssw == NULL on startup
+    // point the VCF at a construction target and find its extent in the reference
+    void set_construction_target(vcflib::VariantCallFile& variantCallFile,
+                                 FastaReference& reference,
+                                 string& target,
+                                 bool target_is_chrom,
+                                 string& seq_name,
+                                 int& start_pos,
+                                 int& stop_pos);
+    // map the start of each non-empty node on the named path to its id, and
+    // any empty nodes at the ends of the path to -1 and the path length, as
+    // from_alleles lays them out. Returns the length of the path.
+    long reference_positions(const string& path_name, map<long, int64_t>& positions);
     // placeholders for empty
     vector<int64_t> empty_ids;
     vector<pair<int64_t, bool>> empty_edge_ends;
@@ -1,9 +1,20 @@
+#include <cstdio>
 #include "vg_set.hpp"
 #include "stream.hpp"
 
 namespace vg {
 // sets of VGs on disk
 
+// Add a value to a sorted vector unless it's already there. The character and
+// position lists of a kmer only ever hold a handful of entries.
+template<typename T, typename V>
+static void insert_sorted(T& container, const V& value) {
+    auto it = lower_bound(container.begin(), container.end(), value);
+    if (it == container.end() || *it != value) {
+        container.insert(it, value);
+    }
+}
+
 void VGset::transform(std::function<void(VG*)> lambda) {
     for (auto& name : filenames) {
         // load
@@ -71,6 +82,13 @@ void VGset::store_paths_in_index(Index& index) {
     });
 }
 
+void VGset::store_path_anchors_in_index(Index& index) {
+    for_each([&index, this](VG* g) {
+        g->show_progress = show_progress;
+        index.store_path_anchors(*g);
+    });
+}
+
 // stores kmers of size kmer_size with stride over paths in graphs in the index
 void VGset::index_kmers(Index& index, int kmer_size, int edge_max, int stride, bool allow_negatives) {
 
@@ -160,7 +178,7 @@ void VGset::write_gcsa_out(ostream& out, int kmer_size, int edge_max, int stride
         // We're going to write out every KmerPosition
         stringstream line;
         // Columns 1 and 2 are the kmer string and the node id:offset start position.
-        line << kp.kmer << '\t' << kp.pos << '\t';
+        line << kp.kmer << '\t' << kp.node_id << ':' << kp.offset << '\t';
         // Column 3 is the comma-separated preceeding character options for this kmer instance.
         for (auto c : kp.prev_chars) line << c << ',';
         // If there are previous characters, kill the last comma. Otherwise, say "$" is the only previous character.
@@ -175,7 +193,7 @@ void VGset::write_gcsa_out(ostream& out, int kmer_size, int edge_max, int stride
         // Column 5 is the node id:offset positions of the places we can go
         // from here. They all start immediately after the last character of
         // this kmer.
-        for (auto& p : kp.next_positions) line << p << ',';
+        for (auto& p : kp.next_positions) line << p.first << ':' << p.second << ',';
         string rec = line.str();
         // handle origin marker
         // Go to the start/end node in forward orientation.
@@ -263,37 +281,34 @@ void VGset::for_each_gcsa_kmer_position_parallel(int kmer_size, int edge_max, in
 #endif
                 KmerPosition& forward_kmer = cache[cache_key];
                 
-                // Add in the kmer string
-                if (forward_kmer.kmer.empty()) forward_kmer.kmer = kmer;
-                
-                // Add in the start position
-                if (forward_kmer.pos.empty()) {
-                    // Figure out if we should be talking about the forward or
-                    // reverse copy of the node to GCSA.
-                    int64_t gcsa_node_id = (*start_node).node->id() * 2 + (*start_node).backward;
-                    // Say we're at this offset on that node. The offset is always
-                    // from the start of the node (which, for the reverse copy,
-                    // corresponds to the end of the forward copy).
-                    stringstream ps; ps << gcsa_node_id << ":" << start_pos;
-                    forward_kmer.pos = ps.str();
+                if (forward_kmer.kmer.empty()) {
+                    // Add in the kmer string
+                    forward_kmer.kmer = kmer;
+                    // Add in the start position. Figure out if we should be
+                    // talking about the forward or reverse copy of the node to
+                    // GCSA, and say we're at this offset on that node. The
+                    // offset is always from the start of the node (which, for
+                    // the reverse copy, corresponds to the end of the forward
+                    // copy).
+                    forward_kmer.node_id = (*start_node).node->id() * 2 + (*start_node).backward;
+                    forward_kmer.offset = start_pos;
                 }
                 
                 // Add in the prev and next characters.
                 for (auto c : prev_chars) {
-                    forward_kmer.prev_chars.insert(c);
+                    insert_sorted(forward_kmer.prev_chars, c);
                 }
                 for (auto c : next_chars) {
-                    forward_kmer.next_chars.insert(c);
+                    insert_sorted(forward_kmer.next_chars, c);
                 }
                 
                 // Add in the next positions
                 for (auto p : next_positions) {
-                    // Figure out if the forward kmer should go next to the forward or reverse copy of the next node.
-                    int64_t target_node = p.first.first * 2 + p.first.second;
-                    
-                    // Say we go to it at the correct offset
-                    stringstream ps; ps << target_node << ":" << p.second;
-                    forward_kmer.next_positions.insert(ps.str());
+                    // Figure out if the forward kmer should go next to the
+                    // forward or reverse copy of the next node, and say we go
+                    // to it at the correct offset.
+                    insert_sorted(forward_kmer.next_positions,
+                                  make_pair(p.first.first * 2 + p.first.second, p.second));
                 }
             }
             
@@ -317,34 +332,32 @@ void VGset::for_each_gcsa_kmer_position_parallel(int kmer_size, int edge_max, in
 #endif
                 KmerPosition& reverse_kmer = cache[cache_key];
                 
-                // Add in the kmer string
-                if (reverse_kmer.kmer.empty()) reverse_kmer.kmer = reverse_complement(kmer);
-                
-                // Add in the start position
-                if (reverse_kmer.pos.empty()) {
-                    // Use the other node ID, facing the other way
-                    int64_t gcsa_node_id = (*end_node).node->id() * 2 + !(*end_node).backward;
-                    // And the distance from the edn of the kmer to the end of its ending node.
-                    stringstream ps; ps << gcsa_node_id << ":" << end_pos;
-                    reverse_kmer.pos = ps.str();
+                if (reverse_kmer.kmer.empty()) {
+                    // Add in the kmer string
+                    reverse_kmer.kmer = reverse_complement(kmer);
+                    // Add in the start position. Use the other node ID, facing
+                    // the other way, and the distance from the end of the kmer
+                    // to the end of its ending node.
+                    reverse_kmer.node_id = (*end_node).node->id() * 2 + !(*end_node).backward;
+                    reverse_kmer.offset = end_pos;
                 }
                     
                 // Add in the prev and next characters.
                 for (auto c : prev_chars) {
-                    reverse_kmer.next_chars.insert(reverse_complement(c));
+                    insert_sorted(reverse_kmer.next_chars, reverse_complement(c));
                 }
                 for (auto c : next_chars) {
-                    reverse_kmer.prev_chars.insert(reverse_complement(c));
+                    insert_sorted(reverse_kmer.prev_chars, reverse_complement(c));
                 }
                 
                 // Add in the next positions (using the prev positions since we're reversing)
                 for (auto p : prev_positions) {
-                    // Figure out if the reverse kmer should go next to the forward or reverse copy of the next node.
-                    int64_t target_node = p.first.first * 2 + !p.first.second;
-                    
-                    // Say we go to it at the correct offset
-                    stringstream ps; ps << target_node << ":" << graph.get_node(p.first.first)->sequence().size() - p.second - 1;
-                    reverse_kmer.next_positions.insert(ps.str());
+                    // Figure out if the reverse kmer should go next to the
+                    // forward or reverse copy of the next node, and say we go
+                    // to it at the correct offset.
+                    int32_t offset = graph.get_node(p.first.first)->sequence().size() - p.second - 1;
+                    insert_sorted(reverse_kmer.next_positions,
+                                  make_pair(p.first.first * 2 + !p.first.second, offset));
                 }
             }
         };
@@ -413,91 +426,117 @@ void VGset::for_each_gcsa_kmer_position_parallel(int kmer_size, int edge_max, in
 
 void VGset::get_gcsa_kmers(int kmer_size, int edge_max, int stride,
                            vector<gcsa::KMer>& kmers_out,
-                           int64_t start_end_id) {
+                           int64_t start_end_id,
+                           size_t buffer_size) {
 
-    // TODO: This function goes through an internal string format that should
-    // really be replaced by making some API changes to gcsa2.
-
-    // We need an alphabet to parse the internal string format
     const gcsa::Alphabet alpha;
     
-    // Each thread is going to make its own KMers, then we'll concatenate these all together at the end.
+    // Each thread is going to make its own KMers, spilling them to its own
+    // temporary file whenever its buffer fills up.
     vector<vector<gcsa::KMer>> thread_outputs;
+    vector<FILE*> thread_spills;
+    vector<size_t> thread_spilled;
     
 #pragma omp parallel
     {
 #pragma omp single
         {
             // Become parallel, get our number of threads, and make one of them make the per-thread outputs big enough.
-            thread_outputs.resize(omp_get_num_threads());
+            int thread_count = omp_get_num_threads();
+            thread_outputs.resize(thread_count);
+            thread_spills.resize(thread_count, nullptr);
+            thread_spilled.resize(thread_count, 0);
         }
     }
-    
-    auto convert_kmer = [&thread_outputs, &alpha, &start_end_id](KmerPosition& kp) {
-        // Convert this KmerPosition to several gcsa::Kmers, and save them in thread_outputs
-                               
-        // We need to make this kmer into a series of tokens
-        vector<string> tokens;
-        
-        // First the kmer
-        tokens.push_back(kp.kmer);
-        
-        // Then the node id:offset
-        tokens.push_back(kp.pos);
-        
-        // Then the comma-separated preceeding characters. See <http://stackoverflow.com/a/18427254/402891>
-        stringstream preceeding;
-        copy(kp.prev_chars.begin(), kp.prev_chars.end(), ostream_iterator<char>(preceeding, ","));
-        if(kp.prev_chars.empty()) {
-            // If we don't have any previous characters, we come from "$"
-            preceeding << "$";
+
+    auto spill = [&thread_outputs, &thread_spills, &thread_spilled](int tid) {
+        auto& output = thread_outputs[tid];
+        if (thread_spills[tid] == nullptr) {
+            thread_spills[tid] = tmpfile();
+            if (thread_spills[tid] == nullptr) {
+                cerr << "error:[VGset::get_gcsa_kmers] could not create temporary file for kmers" << endl;
+                exit(1);
+            }
         }
-        tokens.push_back(preceeding.str());
-        
-        // And the comma-separated subsequent characters.
-        stringstream subsequent;
-        copy(kp.next_chars.begin(), kp.next_chars.end(), ostream_iterator<char>(subsequent, ","));
-        if(kp.next_chars.empty()) {
-            // If we don't have any next characters, we go to "#"
-            subsequent << "#";
+        if (fwrite(output.data(), sizeof(gcsa::KMer), output.size(), thread_spills[tid]) != output.size()) {
+            cerr << "error:[VGset::get_gcsa_kmers] could not write kmers to temporary file" << endl;
+            exit(1);
         }
-        tokens.push_back(subsequent.str());
-        
-        // Finally, each of the node id:offset positions you can go to next (the successors).
-        tokens.insert(tokens.end(), kp.next_positions.begin(), kp.next_positions.end());
-        
+        thread_spilled[tid] += output.size();
+        output.clear();
+    };
+
+    // The predecessor or successor byte GCSA wants: a bit for each character
+    // that can come before or after the kmer, or for the given marker if none can.
+    auto char_bits = [&alpha](const string& chars, char none) {
+        gcsa::byte_type bits = 0;
+        if (chars.empty()) {
+            bits |= 1 << alpha.char2comp[(unsigned char) none];
+        }
+        for (auto c : chars) {
+            bits |= 1 << alpha.char2comp[(unsigned char) c];
+        }
+        return bits;
+    };
+    
+    auto convert_kmer = [&thread_outputs, &spill, &char_bits, &alpha, &start_end_id, buffer_size](KmerPosition& kp) {
+        // Convert this KmerPosition to several gcsa::Kmers, and save them in thread_outputs
+        int tid = omp_get_thread_num();
+        auto& output = thread_outputs[tid];
+
+        gcsa::KMer kmer;
+        kmer.key = gcsa::Key::encode(alpha, kp.kmer, char_bits(kp.prev_chars, '$'), char_bits(kp.next_chars, '#'));
+        kmer.from = gcsa::Node::encode(kp.node_id, kp.offset);
+
         if (kp.next_positions.empty()) {
             // If we didn't have any successors, we have to say we go to the start of the start node
-            tokens.push_back(to_string(start_end_id * 2) + ":0");
-        }    
+            kp.next_positions.emplace_back(start_end_id * 2, 0);
+        }
+
+        // The sink is the reverse copy of the start/end node, made of stop
+        // characters. Kmers that go into it can't be extended, so they still
+        // need to be marked as sorted.
+        int64_t sink_node_id = start_end_id * 2 + 1;
         
-        for(size_t successor_index = 4; successor_index < tokens.size(); successor_index++) {
-            // Now make a GCSA KMer for each of those successors, by passing the
-            // tokens, the alphabet, and the index in the tokens of the
-            // successor.
-            
-            thread_outputs[omp_get_thread_num()].emplace_back(tokens, alpha, successor_index);
-            
-            // Kmers that go to the sink/have stop characters still need to be marked as sorted.
-            if(kp.kmer.rfind('$') != string::npos) {
-                //(*(thread_outputs[omp_get_thread_num()].rbegin())).makeSorted();
-#pragma omp critical
-                {
-                   // cout << "Marked " << *(thread_outputs[omp_get_thread_num()].rbegin()) << " as sorted early" << endl;
-                }
+        for (auto& next : kp.next_positions) {
+            // Now make a GCSA KMer for each of the successors
+            kmer.to = gcsa::Node::encode(next.first, next.second);
+            output.push_back(kmer);
+            if (next.first == sink_node_id && next.second > 0) {
+                output.back().makeSorted();
             }
         }
-        
+
+        if (buffer_size > 0 && output.size() >= buffer_size) {
+            spill(tid);
+        }
     };
     
     // Run on each KmerPosition. This populates start_end_id, if it was 0, before calling convert_kmer.
     for_each_gcsa_kmer_position_parallel(kmer_size, edge_max, stride,
                                          start_end_id, convert_kmer);
-                                         
-    
-    for(auto& thread_output : thread_outputs) {
-        // Now throw everything into the output vector
-        kmers_out.insert(kmers_out.end(), make_move_iterator(thread_output.begin()), make_move_iterator(thread_output.end()));
+
+    // Now throw everything into the output vector, sized up front so we
+    // never hold more than the one copy of the kmers.
+    size_t total = kmers_out.size();
+    for (int i = 0; i < thread_outputs.size(); ++i) {
+        total += thread_spilled[i] + thread_outputs[i].size();
+    }
+    kmers_out.reserve(total);
+
+    for (int i = 0; i < thread_outputs.size(); ++i) {
+        if (thread_spills[i] != nullptr) {
+            rewind(thread_spills[i]);
+            size_t start = kmers_out.size();
+            kmers_out.resize(start + thread_spilled[i]);
+            if (fread(&kmers_out[start], sizeof(gcsa::KMer), thread_spilled[i], thread_spills[i]) != thread_spilled[i]) {
+                cerr << "error:[VGset::get_gcsa_kmers] could not read kmers back from temporary file" << endl;
+                exit(1);
+            }
+            fclose(thread_spills[i]);
+        }
+        kmers_out.insert(kmers_out.end(), thread_outputs[i].begin(), thread_outputs[i].end());
+        vector<gcsa::KMer>().swap(thread_outputs[i]);
     }
     
 }
@@ -36,6 +36,8 @@ public:
     // stores the nodes in the VGs identified by the filenames into the index
     void store_in_index(Index& index);
     void store_paths_in_index(Index& index);
+    // stores where each node meets each path, so path positions don't need a search
+    void store_path_anchors_in_index(Index& index);
 
     // stores kmers of size kmer_size with stride over paths in graphs in the index
     void index_kmers(Index& index, int kmer_size, int edge_max, int stride = 1, 
@@ -48,10 +50,14 @@ public:
     void write_gcsa_out(ostream& out, int kmer_size, int edge_max, int stride,
                         int64_t start_end_id=0);
     
-    // gets all the kmers in GCSA's internal format.
+    // gets all the kmers in GCSA's internal format, with the ones that run
+    // into the sink already marked as sorted. Each thread collects up to
+    // buffer_size kmers before spilling them to a temporary file, and the
+    // files are read back into kmers_out at the end.
     void get_gcsa_kmers(int kmer_size, int edge_max, int stride,
                         vector<gcsa::KMer>& kmers_out,
-                        int64_t start_end_id=0);
+                        int64_t start_end_id=0,
+                        size_t buffer_size=1000000);
 
     bool show_progress;
     
@@ -60,10 +66,14 @@ private:
     // We create a struct that represents each kmer record we want to send to gcsa2
     struct KmerPosition {
         string kmer;
-        string pos;
-        set<char> prev_chars;
-        set<char> next_chars;
-        set<string> next_positions;
+        // where the kmer starts, as a GCSA node id and an offset along it
+        int64_t node_id;
+        int32_t offset;
+        // the characters that can come before and after it, sorted
+        string prev_chars;
+        string next_chars;
+        // the GCSA node ids and offsets we can go to after it, sorted
+        vector<pair<int64_t, int32_t>> next_positions;
     };
     
     // We can loop over these in order to implement the other gcsa-related